@@ -0,0 +1,293 @@
+#!/bin/bash
+--[[ 2>/dev/null;:
+for interpreter in luajit lua lua5.4 lua5.3 lua5.2 lua5.1; do
+  if command -v "$interpreter" >/dev/null 2>&1; then
+    exec "$interpreter" "$0" "$@"
+  fi
+done
+echo "错误: 未找到任何 Lua 解释器 (luajit, lua, lua5.x)" >&2
+exit 1
+]]
+-------------------------------------------------------------------------------
+-- get absolute path of current script
+local function script_path()
+  local fullpath = debug.getinfo(1,"S").source:sub(2)
+  local dirname, filename
+  if package.config:sub(1,1) == '\\' then
+    local dirname_, filename_ = fullpath:match('^(.*\\)([^\\]+)$')
+    if not dirname_ then dirname_ = '.' end
+    if not filename_ then filename_ = fullpath end
+    local command = 'cd ' .. dirname_ .. ' && cd'
+    local p = io.popen(command)
+    fullpath = p and (p:read("*l") .. '\\' .. filename_) or ''
+    if p then p:close() end
+    fullpath = fullpath:gsub('[\n\r]*$','')
+    dirname, filename = fullpath:match('^(.*\\)([^\\]+)$')
+  else
+    local p = io.popen("realpath '"..fullpath.."'", 'r')
+    fullpath = p and p:read('*a') or ''
+    if p then p:close() end
+    fullpath = fullpath:gsub('[\n\r]*$','')
+    dirname, filename = fullpath:match('^(.*/)([^/]-)$')
+  end
+  dirname = dirname or ''
+  filename = filename or fullpath
+  return dirname
+end
+if not RimeApi then
+  --- add the so/dll/lua files in cwd to package.cpath
+  -- get path divider
+  local div = package.config:sub(1,1) == '\\' and '\\' or '/'
+  local script_cpath = script_path() .. div .. '?.dll' .. ';' .. script_path() .. div .. '?.dylib'
+  .. ';' .. script_path() .. div .. '?.so'
+  -- add the ?.so, ?.dylib or ?.dll to package.cpath ensure requiring
+  -- you must keep the rime.dll, librime.dylib or librime.so in current search path
+  package.cpath = package.cpath .. ';' .. script_cpath
+  package.path = script_path() .. div .. '?.lua' .. ';' .. package.path
+  require('rimeapi')
+end
+-------------------------------------------------------------------------------
+local function set_codepage(page)
+  return (package.config:sub(1, 1) == '\\') and set_console_codepage(page) or 0
+end
+local cp = set_codepage(65001) -- set to UTF-8
+-------------------------------------------------------------------------------
+-- cold vs warm start: every round initializes librime, opens a session on
+-- the schema and types the inputs; a cold round first drops the schema's
+-- compiled dictionaries from the page cache (see api:evict_page_cache)
+-- so its first lookups read them from disk, a warm round finds them cached
+local function percentile(values, p)
+  if #values == 0 then return 0 end
+  local sorted = {}
+  for i, v in ipairs(values) do sorted[i] = v end
+  table.sort(sorted)
+  return sorted[math.max(1, math.ceil(#sorted * p))]
+end
+
+local function new_api(user_dir, shared_dir)
+  local api = RimeApi()
+  local t = RimeTraits()
+  t.app_name = "rime_bench.lua"
+  t.shared_data_dir = shared_dir
+  t.user_data_dir = user_dir
+  t.log_dir = "" -- output to stderr
+  api:setup(t)
+  return api, t
+end
+
+-- one round: { ttfc = ms, keys = { ms, ... }, resident = bytes before it };
+-- ttfc is from create_session to the candidates of the first key
+local function bench_round(api, traits, schema_id, keys, cold)
+  local before = cold and api:evict_page_cache(schema_id) or api:get_page_cache_residency(schema_id)
+  api:initialize(traits)
+  local ctx = RimeContext()
+  local started = api:get_steady_time()
+  local session = api:create_session()
+  if not session or not api:select_schema(session, schema_id) then
+    if session then api:destroy_session(session) end
+    api:finalize()
+    return nil
+  end
+  local round = { keys = {}, resident = before.resident, bytes = before.bytes }
+  for i = 1, #keys do
+    local t = api:get_steady_time()
+    api:process_key(session, keys:byte(i), 0)
+    api:get_context(session, ctx)
+    local now = api:get_steady_time()
+    round.keys[i] = (now - t) * 1000
+    if not round.ttfc and ctx.menu.num_candidates > 0 then round.ttfc = (now - started) * 1000 end
+    api:free_context(ctx)
+  end
+  round.ttfc = round.ttfc or (api:get_steady_time() - started) * 1000
+  api:destroy_session(session)
+  api:finalize()
+  return round
+end
+
+local function summary(label, values)
+  return string.format('%-10s min %8.2f  median %8.2f  p90 %8.2f  max %8.2f ms', label,
+    percentile(values, 0), percentile(values, 0.5), percentile(values, 0.9), percentile(values, 1))
+end
+
+local function cold_warm(user_dir, shared_dir, schema_id, keys, rounds)
+  local api, traits = new_api(user_dir, shared_dir)
+  local results = {}
+  for _, mode in ipairs({ 'cold', 'warm' }) do
+    local rs = {}
+    for i = 1, rounds do
+      local r = bench_round(api, traits, schema_id, keys, mode == 'cold')
+      if not r then
+        io.stderr:write('failed to select schema ' .. schema_id .. '\n')
+        return false
+      end
+      rs[i] = r
+    end
+    results[mode] = rs
+  end
+  print(string.format('%s: %d rounds, keys "%s"', schema_id, rounds, keys))
+  for _, mode in ipairs({ 'cold', 'warm' }) do
+    local rs = results[mode]
+    local ttfc, resident = {}, {}
+    for i, r in ipairs(rs) do
+      ttfc[i] = r.ttfc
+      resident[i] = r.bytes > 0 and r.resident * 100 / r.bytes or 0
+    end
+    print(string.format('%s (%.0f%% of %d dictionary bytes cached at start)',
+      mode, percentile(resident, 0.5), rs[1].bytes))
+    print('  ' .. summary('first cand', ttfc))
+    for k = 1, #keys do
+      local lat = {}
+      for i, r in ipairs(rs) do lat[i] = r.keys[k] end
+      print('  ' .. summary(string.format('key %d %s', k, keys:sub(k, k)), lat))
+    end
+  end
+  return true
+end
+-------------------------------------------------------------------------------
+-- schema profile: every schema of get_schema_list is selected on a fresh
+-- session, timing select_schema and the first key and diffing the process
+-- rss and page faults around them (see api:get_resource_usage). A session
+-- frees the dictionaries only it used, those shared with an earlier schema
+-- are not charged again; one-off costs of the process go to the first
+-- schema of the first round, hence the median over the rounds
+local function json_string(s)
+  return '"' .. s:gsub('[%c"\\]', function(c)
+    return ({ ['"'] = '\\"', ['\\'] = '\\\\', ['\n'] = '\\n', ['\t'] = '\\t' })[c]
+      or string.format('\\u%04x', c:byte())
+  end) .. '"'
+end
+
+local function profile_schema(api, schema_id, key)
+  local before = api:get_resource_usage()
+  local started = api:get_steady_time()
+  local session = api:create_session()
+  if not session then return nil end
+  local ok = api:select_schema(session, schema_id)
+  local selected = api:get_steady_time()
+  local after = api:get_resource_usage()
+  local p = {
+    select_ms = (selected - started) * 1000,
+    rss = after.rss - before.rss,
+    minor_faults = after.minor_faults - before.minor_faults,
+    major_faults = after.major_faults - before.major_faults,
+  }
+  if ok then
+    local ctx = RimeContext()
+    api:process_key(session, key:byte(1), 0)
+    api:get_context(session, ctx)
+    p.first_key_ms = (api:get_steady_time() - selected) * 1000
+    p.candidates = ctx.menu.num_candidates
+    api:free_context(ctx)
+  end
+  api:destroy_session(session)
+  return ok and p or nil
+end
+
+local function profile(user_dir, shared_dir, key, rounds, json_path)
+  local api, traits = new_api(user_dir, shared_dir)
+  api:initialize(traits)
+  local list, schemas = RimeSchemaList(), {}
+  if api:get_schema_list(list) then
+    for i = 1, list.size do
+      schemas[i] = { id = list.list[i].schema_id, name = list.list[i].name, runs = {} }
+    end
+    api:free_schema_list(list)
+  end
+  if #schemas == 0 then
+    io.stderr:write('no schema in the schema list of ' .. user_dir .. '\n')
+    api:finalize()
+    return false
+  end
+  for _ = 1, rounds do
+    for _, schema in ipairs(schemas) do
+      local p = profile_schema(api, schema.id, key)
+      if p then schema.runs[#schema.runs + 1] = p else schema.failed = true end
+    end
+  end
+  api:finalize()
+  local fields = { 'select_ms', 'first_key_ms', 'rss', 'minor_faults', 'major_faults', 'candidates' }
+  for _, schema in ipairs(schemas) do
+    for _, field in ipairs(fields) do
+      local values = {}
+      for i, p in ipairs(schema.runs) do values[i] = p[field] end
+      schema[field] = percentile(values, 0.5)
+    end
+  end
+  table.sort(schemas, function(a, b)
+    return a.select_ms + a.first_key_ms > b.select_ms + b.first_key_ms
+  end)
+  print(string.format('%-24s %10s %10s %10s %10s %8s', 'schema', 'select ms', 'key ms',
+    'rss KiB', 'minflt', 'majflt'))
+  for _, s in ipairs(schemas) do
+    print(string.format('%-24s %10.2f %10.2f %10.0f %10.0f %8.0f%s', s.id, s.select_ms, s.first_key_ms,
+      s.rss / 1024, s.minor_faults, s.major_faults, s.failed and '  (failed to select)' or ''))
+  end
+  if json_path then
+    local items = {}
+    for i, s in ipairs(schemas) do
+      items[i] = string.format('{"schema_id":%s,"name":%s,"select_ms":%.3f,"first_key_ms":%.3f,'
+        .. '"rss_delta":%.0f,"minor_faults":%.0f,"major_faults":%.0f,"candidates":%.0f,"failed":%s}',
+        json_string(s.id), json_string(s.name or ''), s.select_ms, s.first_key_ms, s.rss,
+        s.minor_faults, s.major_faults, s.candidates, s.failed and 'true' or 'false')
+    end
+    local json = '{"rounds":' .. rounds .. ',"key":' .. json_string(key)
+      .. ',"schemas":[\n' .. table.concat(items, ',\n') .. '\n]}\n'
+    if json_path == '-' then
+      io.write(json)
+    else
+      local f = io.open(json_path, 'w')
+      if not f then
+        io.stderr:write('failed to write ' .. json_path .. '\n')
+        return false
+      end
+      f:write(json)
+      f:close()
+    end
+  end
+  return true
+end
+-------------------------------------------------------------------------------
+-- -n ROUNDS anywhere among the arguments; --profile [--json FILE]
+local rounds = 5
+local rounds_set, profile_mode, json_path
+local args = {}
+do
+  local i = 1
+  while i <= #arg do
+    if arg[i] == '-n' then
+      rounds = math.max(1, tonumber(arg[i + 1]) or rounds)
+      rounds_set = true
+      i = i + 2
+    elseif arg[i] == '--profile' then
+      profile_mode = true
+      i = i + 1
+    elseif arg[i] == '--json' then
+      json_path = arg[i + 1]
+      i = i + 2
+    else
+      args[#args + 1] = arg[i]
+      i = i + 1
+    end
+  end
+end
+if #args < (profile_mode and 2 or 3) then
+  print("Usage: lua rime_bench.lua [-n rounds] user_data_dir shared_data_dir schema_id [keys]")
+  print("       lua rime_bench.lua --profile [-n rounds] [--json file] user_data_dir shared_data_dir [key]")
+  print("Example: lua rime_bench.lua -n 10 ./user_data ./shared_data luna_pinyin nihao")
+  print("Times the first candidate and every key of keys (nihao by default) after initialize,")
+  print("  with the schema's dictionaries evicted from the page cache (cold) and cached (warm);")
+  print("  the schemas must be deployed already")
+  print("--profile selects every schema of the schema list on a fresh session and reports the time")
+  print("  of select_schema and of the first key (a by default), the rss growth and the page faults,")
+  print("  slowest first, medians of the rounds (1 by default); --json writes them to file, - for stdout")
+  set_codepage(cp)
+  os.exit(0)
+end
+local ok
+if profile_mode then
+  ok = profile(args[1], args[2], args[3] or 'a', rounds_set and rounds or 1, json_path)
+else
+  ok = cold_warm(args[1], args[2], args[3], args[4] or 'nihao', rounds)
+end
+set_codepage(cp)
+os.exit(ok and 0 or 1)
@@ -52,7 +52,65 @@ local function set_codepage(page)
 end
 local cp = set_codepage(65001) -- set to UTF-8
 -------------------------------------------------------------------------------
-local function deployer(user_dir, shared_dir, staging_dir)
+local is_windows = package.config:sub(1, 1) == '\\'
+local div = is_windows and '\\' or '/'
+-- for the shell: inside double quotes sh still expands $, ` and \, cmd
+-- has no escape there but no path can hold a " on Windows
+local function quote(path)
+  if is_windows then return '"' .. path .. '"' end
+  return '"' .. path:gsub('[\\"$`]', '\\%0') .. '"'
+end
+local function join(dir, name)
+  return (dir:sub(-1) == '/' or dir:sub(-1) == '\\') and dir .. name or dir .. div .. name
+end
+local function exists(path)
+  local f = io.open(path, 'rb')
+  if f then f:close() return true end
+  return false
+end
+local function file_size(path)
+  local f = io.open(path, 'rb')
+  if not f then return 0 end
+  local size = f:seek('end') or 0
+  f:close()
+  return size
+end
+local function list_dir(dir)
+  local names = {}
+  local p = io.popen(is_windows and ('dir /b ' .. quote(dir) .. ' 2>nul')
+    or ('ls -1A ' .. quote(dir) .. ' 2>/dev/null'))
+  if not p then return names end
+  for line in p:lines() do
+    line = line:gsub('[\r\n]*$', '')
+    if line ~= '' then names[#names + 1] = line end
+  end
+  p:close()
+  return names
+end
+local function rmdir(path)
+  os.execute(is_windows and ('rd /s /q ' .. quote(path) .. ' 2>nul')
+    or ('rm -rf ' .. quote(path)))
+end
+local function mkdir(path)
+  if os.mkdir then return os.mkdir(path) end
+  os.execute((is_windows and 'md ' or 'mkdir -p ') .. quote(path))
+  return true
+end
+local function cpu_count()
+  local n
+  if is_windows then
+    n = tonumber(os.getenv('NUMBER_OF_PROCESSORS'))
+  else
+    local p = io.popen('nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null')
+    n = p and tonumber(p:read('*l'))
+    if p then p:close() end
+  end
+  return n or 1
+end
+-------------------------------------------------------------------------------
+-- with a cache ({ dir=, size= }), schema_files are deployed through the
+-- artifact cache first and the maintenance finds their dictionaries built
+local function deployer(user_dir, shared_dir, staging_dir, cache, schema_files)
   local api = RimeApi()
   local t = RimeTraits()
   t.app_name = "rime_deployer.lua"
@@ -62,20 +120,436 @@ local function deployer(user_dir, shared_dir, staging_dir)
   t.log_dir = "" -- output to stderr
   api:setup(t)
   api:initialize(t)
+  if cache and schema_files then
+    local r = api:deploy_incremental(schema_files, { cache = cache.dir, cache_size = cache.size })
+    print(string.format('restored %d/%d schemas from %s', #r.restored, #schema_files, cache.dir))
+  end
   api:start_maintenance(true)
   api:finalize()
 end
 -------------------------------------------------------------------------------
-if #arg == 0 then
-  print("Usage: lua rime_deployer.lua [user_data_dir] [shared_data_dir] [staging_dir (optional)]")
+-- parallel mode: the schemas are split into groups sharing a dictionary,
+-- each group goes to one of N worker processes which deploy_schema into a
+-- private staging dir; the outputs are merged into the build dir at the end
+local function deployer_api(user_dir, shared_dir, staging_dir)
+  local api = RimeApi()
+  local t = RimeTraits()
+  t.app_name = "rime_deployer.lua"
+  t.shared_data_dir = shared_dir
+  t.user_data_dir = user_dir
+  t.staging_dir = staging_dir
+  t.log_dir = "" -- output to stderr
+  api:setup(t)
+  api:deployer_initialize(t)
+  return api
+end
+
+-- user data overrides shared data, like librime's resolver
+local function source_file(user_dir, shared_dir, name)
+  local path = join(user_dir, name)
+  if exists(path) then return path end
+  path = join(shared_dir, name)
+  if exists(path) then return path end
+  return nil
+end
+
+local function load_yaml(path)
+  local config = RimeConfig()
+  if path and config:load_file(path) then return config end
+  return nil
+end
+
+local function read_list(config, key, field)
+  local list = {}
+  while config do
+    local item = config:get_string(key .. '/@' .. #list .. (field and ('/' .. field) or ''))
+    if not item then break end
+    list[#list + 1] = item
+  end
+  return list
+end
+
+-- schema ids from default.yaml (schema_list patched by default.custom.yaml),
+-- all *.schema.yaml of the shared dir without one, plus their dependencies
+local function list_schemas(user_dir, shared_dir)
+  local ids = read_list(load_yaml(source_file(user_dir, shared_dir, 'default.custom.yaml')),
+    'patch/schema_list', 'schema')
+  if #ids == 0 then
+    ids = read_list(load_yaml(source_file(user_dir, shared_dir, 'default.yaml')),
+      'schema_list', 'schema')
+  end
+  if #ids == 0 then
+    for _, name in ipairs(list_dir(shared_dir)) do
+      local id = name:match('^(.+)%.schema%.yaml$')
+      if id then ids[#ids + 1] = id end
+    end
+  end
+  local schemas, seen = {}, {}
+  local function add(id)
+    if seen[id] then return end
+    seen[id] = true
+    local file = source_file(user_dir, shared_dir, id .. '.schema.yaml')
+    if not file then
+      io.stderr:write('schema not found: ' .. id .. '\n')
+      return
+    end
+    local config = load_yaml(file)
+    local dictionary = config and config:get_string('translator/dictionary') or nil
+    local dict_file = dictionary and source_file(user_dir, shared_dir, dictionary .. '.dict.yaml')
+    schemas[#schemas + 1] = {
+      id = id, file = file, dictionary = dictionary or id,
+      weight = file_size(file) + (dict_file and file_size(dict_file) or 0),
+    }
+    for _, dep in ipairs(read_list(config, 'schema/dependencies')) do add(dep) end
+  end
+  for _, id in ipairs(ids) do add(id) end
+  return schemas
+end
+
+-- schemas sharing a dictionary stay together so it is compiled once;
+-- largest group first onto the least loaded worker
+local function partition(schemas, jobs)
+  local groups, by_dict = {}, {}
+  for _, schema in ipairs(schemas) do
+    local group = by_dict[schema.dictionary]
+    if not group then
+      group = { weight = 0 }
+      by_dict[schema.dictionary] = group
+      groups[#groups + 1] = group
+    end
+    group[#group + 1] = schema
+    group.weight = math.max(group.weight, schema.weight)
+  end
+  table.sort(groups, function(a, b) return a.weight > b.weight end)
+  local workers = {}
+  for i = 1, math.min(jobs, #groups) do workers[i] = { weight = 0 } end
+  for _, group in ipairs(groups) do
+    local target = workers[1]
+    for _, w in ipairs(workers) do
+      if w.weight < target.weight then target = w end
+    end
+    for _, schema in ipairs(group) do target[#target + 1] = schema end
+    target.weight = target.weight + group.weight
+  end
+  return workers
+end
+
+-- runs in the worker process, one "ok|restored|fail <schema_file>" line per
+-- schema
+local function deploy_worker(user_dir, shared_dir, staging_dir, files, cache)
+  mkdir(staging_dir)
+  local api = deployer_api(user_dir, shared_dir, staging_dir)
+  local failed = 0
+  if cache then
+    local r = api:deploy_incremental(files, { cache = cache.dir, cache_size = cache.size, force = true })
+    os.remove(staging_dir .. '.manifest')
+    for _, file in ipairs(r.deployed) do io.write('ok ' .. file .. '\n') end
+    for _, file in ipairs(r.restored) do io.write('restored ' .. file .. '\n') end
+    for _, file in ipairs(r.failed) do io.write('fail ' .. file .. '\n') end
+    failed = #r.failed
+  else
+    for _, file in ipairs(files) do
+      local ok = api:deploy_schema(file)
+      if not ok then failed = failed + 1 end
+      io.write((ok and 'ok ' or 'fail ') .. file .. '\n')
+      io.flush()
+    end
+  end
+  api:finalize()
+  return failed == 0
+end
+
+-- copy of one file, false when it can not be read or written
+local function copy_file(src, dst)
+  local input = io.open(src, 'rb')
+  if not input then return false end
+  local output = io.open(dst, 'wb')
+  if not output then input:close() return false end
+  local ok = true
+  while true do
+    local chunk = input:read(65536)
+    if not chunk then break end
+    if not output:write(chunk) then ok = false break end
+  end
+  input:close()
+  return output:close() and ok
+end
+
+-- move every file of src into dst, replacing existing ones
+local function move_files(src, dst)
+  for _, name in ipairs(list_dir(src)) do
+    local target = join(dst, name)
+    os.remove(target)
+    if not os.rename(join(src, name), target) then
+      io.stderr:write('failed to move ' .. join(src, name) .. '\n')
+    end
+  end
+end
+
+local function parallel_deployer(user_dir, shared_dir, staging_dir, jobs, cache)
+  local build_dir = staging_dir or join(user_dir, 'build')
+  local schemas = list_schemas(user_dir, shared_dir)
+  local workers = partition(schemas, jobs)
+  local interpreter, script = arg[-1] or 'lua', arg[0]
+  local started = os.time()
+  -- start every worker before reading any of them
+  local pipes = {}
+  for i, worker in ipairs(workers) do
+    local cmd = { quote(interpreter), quote(script), '--worker',
+      quote(user_dir), quote(shared_dir), quote(build_dir .. '.worker' .. i),
+      quote(cache and cache.dir or ''), tostring(cache and cache.size or 0) }
+    for _, schema in ipairs(worker) do cmd[#cmd + 1] = quote(schema.file) end
+    local command = table.concat(cmd, ' ')
+    -- cmd /c strips the first and last quote of a command line starting
+    -- with one, the extra pair keeps the quoted interpreter and args intact
+    if is_windows then command = '"' .. command .. '"' end
+    pipes[i] = io.popen(command, 'r')
+  end
+  local deployed, restored, failed, died = 0, 0, {}, 0
+  for i, pipe in ipairs(pipes) do
+    local reported = {}
+    local alive = pipe ~= nil
+    if pipe then
+      for line in pipe:lines() do
+        local status, file = line:match('^(%a+) (.*)$')
+        if status then reported[file] = true end
+        if status == 'ok' then deployed = deployed + 1
+        elseif status == 'restored' then
+          deployed, restored = deployed + 1, restored + 1
+        elseif status == 'fail' then failed[#failed + 1] = file end
+      end
+      -- exit 1 only means some schema failed; Lua 5.1 tells nothing here,
+      -- a schema without a line gives a crashed worker away there
+      local _, how, code = pipe:close()
+      if how == 'signal' or (how == 'exit' and code ~= 0 and code ~= 1) then alive = false end
+    else
+      io.stderr:write('failed to start worker ' .. i .. '\n')
+    end
+    for _, schema in ipairs(workers[i]) do
+      if not reported[schema.file] then
+        alive = false
+        failed[#failed + 1] = schema.file
+      end
+    end
+    if not alive then
+      died = died + 1
+      if pipe then io.stderr:write('worker ' .. i .. ' died\n') end
+    end
+  end
+  -- a dead worker may have left its staging dir half written, the old
+  -- build stays in place
+  if died > 0 then
+    for i = 1, #workers do rmdir(build_dir .. '.worker' .. i) end
+    print(string.format('%d of %d workers failed, %s left unchanged', died, #workers, build_dir))
+    for _, file in ipairs(failed) do print('failed: ' .. file) end
+    return false
+  end
+  -- merge: worker outputs, then default.yaml, then a copy of whatever of
+  -- the old build was not rebuilt, the build dir stays whole meanwhile. The
+  -- finished dir then replaces it by two renames, not atomically: between
+  -- them there is no build dir, and a failed second rename puts the old one
+  -- back
+  local merge_dir = build_dir .. '.merge'
+  rmdir(merge_dir)
+  mkdir(merge_dir)
+  for i = 1, #workers do
+    move_files(build_dir .. '.worker' .. i, merge_dir)
+    rmdir(build_dir .. '.worker' .. i)
+  end
+  local api = deployer_api(user_dir, shared_dir, merge_dir)
+  if not api:deploy_config_file('default.yaml', 'config_version') then
+    io.stderr:write('failed to deploy default.yaml\n')
+  end
+  api:finalize()
+  local merged = {}
+  for _, name in ipairs(list_dir(merge_dir)) do merged[name] = true end
+  for _, name in ipairs(list_dir(build_dir)) do
+    if not merged[name] and not copy_file(join(build_dir, name), join(merge_dir, name)) then
+      io.stderr:write('failed to carry over ' .. join(build_dir, name) .. '\n')
+    end
+  end
+  local old_dir = build_dir .. '.old'
+  rmdir(old_dir)
+  local had_build = os.isdir(build_dir)
+  if had_build and not os.rename(build_dir, old_dir) then
+    rmdir(merge_dir)
+    print('failed to move ' .. build_dir .. ' aside, left unchanged')
+    return false
+  end
+  if not os.rename(merge_dir, build_dir) then
+    if had_build then os.rename(old_dir, build_dir) end
+    rmdir(merge_dir)
+    print('failed to replace ' .. build_dir .. ', left unchanged')
+    return false
+  end
+  rmdir(old_dir)
+  print(string.format('deployed %d/%d schemas with %d workers in %ds',
+    deployed, #schemas, #workers, os.time() - started))
+  if cache then print(string.format('restored %d schemas from %s', restored, cache.dir)) end
+  for _, file in ipairs(failed) do print('failed: ' .. file) end
+  return #failed == 0
+end
+-------------------------------------------------------------------------------
+-- watch mode: the user and shared dirs are watched, every batch of changed
+-- files redeploys the schemas using them (see api:deploy_inputs) through
+-- deploy_incremental, which skips files saved unchanged
+local function basename(path) return path:match('[^/\\]+$') or path end
+
+local function watch_deployer(user_dir, shared_dir, staging_dir, debounce_ms)
+  local build_dir = staging_dir or join(user_dir, 'build')
+  mkdir(build_dir)
+  local api = deployer_api(user_dir, shared_dir, build_dir)
+  local watcher, err = api:watch({ user_dir, shared_dir })
+  if not watcher then
+    io.stderr:write('failed to watch: ' .. tostring(err) .. '\n')
+    api:finalize()
+    return false
+  end
+  local function ms_since(t) return (api:get_steady_time() - t) * 1000 end
+  -- file name -> ids of the schemas using it, 'default' for default.yaml;
+  -- names because a user file replaces the shared one of the same name
+  local function index()
+    local by_id, users = { default = 'default.yaml' }, {}
+    local function add(id, file)
+      for _, path in ipairs(api:deploy_inputs(file)) do
+        local name = basename(path)
+        users[name] = users[name] or {}
+        table.insert(users[name], id)
+      end
+    end
+    add('default', 'default.yaml')
+    for _, schema in ipairs(list_schemas(user_dir, shared_dir)) do
+      by_id[schema.id] = schema.file
+      add(schema.id, schema.file)
+    end
+    return by_id, users
+  end
+  local by_id, users = index()
+  -- catch up with the changes made while not watching
+  local started = api:get_steady_time()
+  local files = {}
+  for _, file in pairs(by_id) do files[#files + 1] = file end
+  local r = api:deploy_incremental(files)
+  print(string.format('deployed %d, %d up to date in %.0f ms; watching %s and %s',
+    #files - #r.skipped - #r.failed, #r.skipped, ms_since(started), user_dir, shared_dir))
+  for _, file in ipairs(r.failed) do print('failed: ' .. file) end
+  while true do
+    local changed, overflow = watcher:wait(debounce_ms)
+    -- yaml and txt only, not the manifest written beside the build dir
+    local relevant = overflow
+    for _, path in ipairs(changed or {}) do
+      relevant = relevant or path:match('%.yaml$') or path:match('%.txt$')
+    end
+    if relevant then
+      started = api:get_steady_time()
+      local old_by_id, old_users = by_id, users
+      by_id, users = index()
+      local affected, order = {}, {}
+      local function affect(id)
+        if affected[id] or not by_id[id] then return end
+        affected[id] = true
+        order[#order + 1] = id
+      end
+      for _, path in ipairs(changed) do
+        for _, id in ipairs(old_users[basename(path)] or {}) do affect(id) end
+        for _, id in ipairs(users[basename(path)] or {}) do affect(id) end
+      end
+      -- new in the schema list, or anything after lost events
+      for id in pairs(by_id) do
+        if overflow or not old_by_id[id] then affect(id) end
+      end
+      local deployed = 0
+      for _, id in ipairs(order) do
+        local t = api:get_steady_time()
+        r = api:deploy_incremental({ by_id[id] })
+        local status = #r.failed > 0 and 'failed' or #r.skipped > 0 and 'unchanged' or 'deployed'
+        if status == 'deployed' then deployed = deployed + 1 end
+        print(string.format('%s %s in %.0f ms', status, id, ms_since(t)))
+      end
+      if #order > 0 then
+        print(string.format('%d changed files, %d/%d schemas redeployed in %.0f ms',
+          #changed, deployed, #order, ms_since(started)))
+      end
+      io.flush()
+    end
+  end
+end
+-------------------------------------------------------------------------------
+if arg[1] == '--worker' then
+  local files = {}
+  for i = 7, #arg do files[#files + 1] = arg[i] end
+  local cache = arg[5] ~= '' and { dir = arg[5], size = tonumber(arg[6]) or 0 } or nil
+  local ok = deploy_worker(arg[2], arg[3], arg[4], files, cache)
+  set_codepage(cp)
+  os.exit(ok and 0 or 1)
+end
+-- -j N / --jobs N anywhere among the arguments, 0 for one per cpu;
+-- --cache DIR and --cache-size MB for the artifact cache;
+-- --watch [--debounce MS] for the watch mode
+local jobs, cache, watch, debounce
+local args = {}
+do
+  local i = 1
+  while i <= #arg do
+    if arg[i] == '-j' or arg[i] == '--jobs' then
+      jobs = tonumber(arg[i + 1]) or 0
+      i = i + 2
+    elseif arg[i] == '--watch' then
+      watch = true
+      i = i + 1
+    elseif arg[i] == '--debounce' then
+      debounce = tonumber(arg[i + 1])
+      i = i + 2
+    elseif arg[i] == '--cache' then
+      cache = cache or {}
+      cache.dir = arg[i + 1]
+      i = i + 2
+    elseif arg[i] == '--cache-size' then
+      cache = cache or {}
+      cache.size = math.floor((tonumber(arg[i + 1]) or 0) * 1024 * 1024)
+      i = i + 2
+    else
+      args[#args + 1] = arg[i]
+      i = i + 1
+    end
+  end
+end
+if jobs == 0 then jobs = cpu_count() end
+if cache and not cache.dir then cache = nil end
+-------------------------------------------------------------------------------
+if #args == 0 then
+  print("Usage: lua rime_deployer.lua [-j jobs] [--cache dir [--cache-size MB]] [--watch [--debounce MS]] [user_data_dir] [shared_data_dir] [staging_dir (optional)]")
   print("Example: lua rime_deployer.lua ./user_data ./shared_data ./staging")
   print("The output deployed files will be in user_data_dir/build or staging_dir if provided")
+  print("-j N deploys the schemas in N worker processes, -j 0 uses one per cpu;")
+  print("  the result replaces the build dir by two renames, briefly leaving none")
+  print("--cache dir restores compiled dictionaries from dir and stores new ones there,")
+  print("  keeping it under --cache-size MB (1024 by default)")
+  print("--watch redeploys the schemas using the files changed in the data dirs until interrupted,")
+  print("  --debounce MS waits for MS quiet milliseconds before redeploying (100 by default)")
   set_codepage(cp)
   os.exit(0)
 end
 -------------------------------------------------------------------------------
-local user_dir = arg[1] or "."
-local shared_dir = arg[2] or "."
-local staging_dir = arg[3] or nil
-deployer(user_dir, shared_dir, staging_dir)
+local user_dir = args[1] or "."
+local shared_dir = args[2] or "."
+local staging_dir = args[3] or nil
+if watch then
+  local ok = watch_deployer(user_dir, shared_dir, staging_dir, debounce or 100)
+  set_codepage(cp)
+  os.exit(ok and 0 or 1)
+end
+if jobs and jobs > 1 then
+  local ok = parallel_deployer(user_dir, shared_dir, staging_dir, jobs, cache)
+  set_codepage(cp)
+  os.exit(ok and 0 or 1)
+end
+local schema_files
+if cache then
+  schema_files = {}
+  for _, schema in ipairs(list_schemas(user_dir, shared_dir)) do
+    schema_files[#schema_files + 1] = schema.file
+  end
+end
+deployer(user_dir, shared_dir, staging_dir, cache, schema_files)
 set_codepage(cp)
@@ -63,6 +63,7 @@
 ---@field reload fun(self: self, config_name: string): boolean
 ---@field open fun(self: self, config_name: string): boolean
 ---@field close fun(self: self): boolean
+---@field load_file fun(self: self, path: string, cp: integer|nil): boolean -- load yaml file through a memory map, cp is codepage of path for windows
 ---@field get_int fun(self: self, key: string): integer
 ---@field get_string fun(self: self, key: string, buffer_size: integer|nil): string
 ---@field get_bool fun(self: self, key: string): boolean
@@ -74,6 +75,14 @@
 ---@field set_double fun(self: self, key: string, value: number): boolean
 ---@field type string
 
+---@class RimeSchemaRecord -- plain table returned by RimeLeversApi:get_schema_catalog
+---@field schema_id string
+---@field name string|nil
+---@field version string|nil
+---@field author string|nil
+---@field description string|nil
+---@field file_path string|nil
+
 ---@class RimeConfigIterator
 ---@field index integer -- index of iterator, 0 base
 ---@field key string -- key string of iterator
@@ -103,7 +112,7 @@
 
 ---@class RimeSchemaList
 ---@field size integer
----@field list RimeSchemaListItem[]
+---@field list RimeSchemaListItem[] -- copy of the items cached since the list was last filled
 ---@field type string
 
 ---@class RimeStringSlice
@@ -135,7 +144,7 @@
 
 ---@class RimeApi
 ---@field setup fun(self: self, traits: RimeTraits): nil
----@field set_notification_handler fun(self: self, handler: (fun(context_object: any, session: RimeSession|integer, msg_type: string, msg_value: any)) | nil): nil
+---@field set_notification_handler fun(self: self, handler: (fun(context_object: any, session: RimeSession|integer, msg_type: string, msg_value: any, timestamp: number)) | (fun(context_object: any, records: RimeNotificationRecord[])) | nil, options: integer|RimeNotificationOptions|nil): boolean, string|nil true, or false and why when a new capacity can not be applied now (inside a handler, during maintenance or a running task), nothing changed then and the call can be retried
 ---@field initialize fun(self: self, traits: RimeTraits): nil
 ---@field finalize fun(self: self): nil
 ---@field start_maintenance fun(self: self, full_check: boolean): boolean
@@ -146,6 +155,24 @@
 ---@field deploy fun(self: self): boolean
 ---@field deploy_schema fun(self: self, schema_file: string): boolean
 ---@field deploy_config_file fun(self: self, file_name: string, version_key: string): boolean
+---@field start_maintenance_async fun(self: self, full_check: boolean): RimeTask start_maintenance + join_maintenance_thread on a worker thread; the deploy tasks raise unless set_concurrency_mode(true), they run one at a time while sessions keep being served
+---@field deploy_async fun(self: self): RimeTask needs concurrency mode
+---@field async fun(self: self, method: 'sync_user_data'|'select_schema'|'backup_user_dict'|'export_user_dict'|'import_user_dict', ...): RimeTask run the call on a worker pool, the task result is what the synchronous call returns; needs concurrency mode
+---@field deploy_schema_async fun(self: self, schema_file: string): RimeTask needs concurrency mode
+---@field deploy_config_file_async fun(self: self, file_name: string, version_key: string): RimeTask needs concurrency mode
+---@field deploy_incremental fun(self: self, items: (string|{file: string, version_key: string|nil})[], options: {manifest: string|nil, threads: integer|nil, force: boolean|nil, cache: string|nil, cache_size: integer|nil}|nil): {deployed: string[], skipped: string[], failed: string[], restored: string[]} deploy the schemas and config files whose inputs changed since the last call, the manifest defaults to <staging_dir>.manifest; cache is a dir of compiled dictionaries shared between runs, bounded to cache_size bytes (1 GiB by default)
+---@field deploy_inputs fun(self: self, file: string, version_key: string|nil): string[] files whose change makes deploy_incremental redeploy the schema file or config file
+---@field watch fun(self: self, dirs: string[]): RimeWatcher|nil, string|nil watch dirs (not recursive) for changed files, inotify on Linux only
+---@field prefetch fun(self: self, schema_id: string, lock: boolean|nil): RimeTask pull the compiled dictionaries of the deployed schema into the page cache on a worker, kept mlock'ed with lock; the task result is the bytes prefetched
+---@field get_prefetch_stats fun(self: self): RimePrefetchStats of the last finished prefetch
+---@field prefetch_unlock fun(self: self): integer release the dictionaries locked by prefetch, returns the bytes unlocked
+---@field get_page_cache_residency fun(self: self, schema_id: string): {files: integer, bytes: integer, resident: integer} bytes of the schema's compiled dictionaries in the page cache
+---@field evict_page_cache fun(self: self, schema_id: string): {files: integer, bytes: integer, resident: integer} drops the schema's compiled dictionaries from the page cache with posix_fadvise(DONTNEED), returns what is left; call it between finalize and initialize
+---@field get_resource_usage fun(self: self): RimeResourceUsage memory and page faults of this process, to diff around a call
+---@field use_memory_dirs fun(self: self, traits: RimeTraits, seed_dir: string|nil): string|nil, string|nil points the user data, staging and log dirs of traits to a fresh dir on tmpfs (/dev/shm) seeded with a copy of seed_dir (build/*.bin copied, not hardlinked), call before setup; returns the dir, or nil and the error
+---@field release_memory_dirs fun(self: self): integer removes the dirs made by use_memory_dirs after finalize, returns how many; done at exit otherwise
+---@field clone_user_data_dir fun(self: self, template_dir: string, dest_dir: string, link_artifacts: boolean|nil): RimeCloneStats|nil, string|nil clones a deployed user data dir into a new or empty dest_dir for a worker's RimeTraits: reflinks, else hardlinks build/*.bin (made read-only) unless link_artifacts is false, and copies the rest; on failure dest_dir is removed, or emptied if it existed
+---@field warm_up fun(self: self, schema_id: string, inputs: string[]|integer|nil): RimeWarmUpSample[] type each input into a hidden session and clear it; without a list, the count (50) most common first syllables of the schema's dictionary
 ---@field sync_user_data fun(self: self): boolean
 ---@field create_session fun(self: self): RimeSession
 ---@field find_session fun(self: self, session: RimeSession|integer): boolean
@@ -165,7 +192,7 @@
 ---@field get_option fun(self: self, session: RimeSession|integer, option_name: string): boolean
 ---@field set_property fun(self: self, session: RimeSession|integer, property_name: string, value: string): nil
 ---@field get_property fun(self: self, session: RimeSession|integer, property_name: string, buffer_size: integer|nil): string |nil
----@field get_schema_list fun(self: self, schema_list: RimeSchemaList): boolean
+---@field get_schema_list fun(self: self, schema_list: RimeSchemaList): boolean -- a filled list is kept until the next deploy, select_schemas or save_settings
 ---@field free_schema_list fun(self: self, schema_list: RimeSchemaList): nil
 ---@field get_current_schema fun(self: self, session: RimeSession|integer, buffer_size: integer): string|nil
 ---@field select_schema fun(self: self, session: RimeSession|integer, schema_id: string): boolean
@@ -229,9 +256,80 @@
 ---@field highlight_candidate fun(self: self, session: RimeSession|integer, index: integer): boolean -- index shall be 0 base
 ---@field highlight_candidate_on_current_page fun(self: self, session: RimeSession|integer, index: integer): boolean -- index shall be 0 base
 ---@field change_page fun(self: self, session: RimeSession|integer, backward: boolean): boolean
----@field drain_notifications fun(self: self): nil drain all pending notifications
+---@field drain_notifications fun(self: self): nil drain all pending notifications; the handler gets Lua strings, copies that stay valid (the FFI bridge's peek_notifications hands out raw pointers valid only until its next peek or drain)
+---@field get_notification_stats fun(self: self): RimeNotificationStats
+---@field get_steady_time fun(self: self): number seconds on the steady clock used by notification timestamps
+---@field set_concurrency_mode fun(self: self, enabled: boolean): boolean process-wide; serializes librime calls per session (or globally for deploy, config, schema and session table calls) for use from several threads, returns the previous mode
+---@field get_concurrency_mode fun(self: self): boolean
+---@field get_deploy_timings fun(self: self, clear: boolean|nil): RimeDeployTiming[] deploy runs seen since the notification handler was installed, at most 64
+---@field get_notification_fd fun(self: self): integer|nil fd readable once notifications arrive after the last drain, nil on Windows
 ---@field type string
 
+---@class RimeNotificationOptions
+---@field capacity integer|nil capacity of the notification queue, rounded up to a power of 2, default 1024, at most 1048576 (1 << 20); queued messages are kept when it changes
+---@field batch boolean|nil call the handler once per drain with an array of RimeNotificationRecord
+---@field types string[]|nil only queue these message types
+---@field sessions (RimeSession|integer)[]|nil only queue messages of these sessions, messages without a session always pass
+---@field coalesce boolean|nil keep only the latest option value per (session, option) until the next drain
+
+---@class RimeNotificationRecord
+---@field session RimeSession
+---@field type string
+---@field value string
+---@field timestamp number steady clock seconds when librime posted the message
+
+---@class RimeTask handle of an async deploy, wait for it before finalize; collecting it leaves the worker running, librime is only unloaded once it returned
+---@field done fun(self: self): boolean
+---@field ready fun(self: self): boolean same as done
+---@field wait fun(self: self, timeout: number|nil): any, string|nil deploy tasks give ok and 'success'|'failure'|'skipped'|'unknown' (no outcome was notified), async calls what the call returns, or nil, 'timeout'; no timeout, a negative one or math.huge waits until done; inside a coroutine it yields the task, the caller resumes the coroutine (once fd() is readable) until done
+---@field result fun(self: self): boolean|nil, string|nil nil while running
+---@field fd fun(self: self): integer|nil fd readable once done, nil on Windows
+
+---@class RimeWatcher files written, moved or deleted in the watched dirs, from api:watch
+---@field wait fun(self: self, debounce_ms: integer|nil, timeout: number|nil): string[]|nil, boolean|string changed paths once the dirs stay quiet for debounce_ms (100 by default) and whether events were dropped, or nil, 'timeout'
+---@field fd fun(self: self): integer|nil fd readable while events are pending
+---@field close fun(self: self)
+
+---@class RimePrefetchStats
+---@field files integer files prefetched
+---@field bytes integer bytes prefetched
+---@field locked integer bytes kept mlock'ed by every prefetch so far
+---@field seconds number time taken
+
+---@class RimeResourceUsage
+---@field rss integer resident set size in bytes
+---@field max_rss integer peak resident set size in bytes
+---@field minor_faults integer page faults served from memory
+---@field major_faults integer page faults that read from disk
+
+---@class RimeCloneStats
+---@field files integer regular files cloned
+---@field cloned integer files sharing blocks copy-on-write (reflink)
+---@field linked integer build artifacts hardlinked
+---@field copied integer files copied
+---@field bytes_copied integer bytes of the copied files
+---@field seconds number time taken
+
+---@class RimeWarmUpSample
+---@field input string as given, only its speller/alphabet characters are typed
+---@field seconds number from the first key to the first page of candidates
+---@field candidates integer candidates on that page
+---@field committed boolean the schema committed (and learned) something by itself
+
+---@class RimeDeployTiming
+---@field start number steady clock seconds of deploy/start
+---@field finish number steady clock seconds of deploy/success or deploy/failure
+---@field duration number seconds
+---@field result string 'success' or 'failure'
+
+---@class RimeNotificationStats
+---@field capacity integer
+---@field pending integer messages waiting for drain_notifications
+---@field dropped integer messages lost because the queue was full
+---@field overflowed integer strings that did not fit the preallocated slot storage
+---@field filtered integer messages rejected by types/sessions, over every filter set
+---@field coalesced integer option values replaced by a newer one before the drain
+
 ---@class RimeCustomSettings
 ---@field type string
 ---@class RimeSwitcherSettings
@@ -273,6 +371,8 @@
 ---@field export_user_dict fun(self: self, dict_name: string, text_file: string): integer
 ---@field import_user_dict fun(self: self, dict_name: string, text_file: string): integer
 ---@field customize_item fun(self: self, settings: RimeCustomSettings, key: string, value: RimeConfig): boolean
+---@field customize_batch fun(self: self, settings: RimeCustomSettings, tbl: table): boolean, string|nil -- apply a flat or nested table of path -> value, then save once if modified; arrays become lists; an empty table is a no-op; false and a message for an invalid table (nothing applied) or a failed entry. A failed entry reloads settings from disk, discarding ALL unsaved edits, those made before the call included: save them first
+---@field get_schema_catalog fun(self: self): RimeSchemaRecord[]|nil -- all available schemas with metadata, cached until next deploy
 ---@field type string
 
 ---@return RimeApi
@@ -306,9 +306,76 @@ ffi.cdef[[
     const char** message_types,
     const char** message_values,
     size_t max_messages);
+  size_t drain_notifications_timed(
+    RimeSessionId* session_ids,
+    const char** message_types,
+    const char** message_values,
+    int64_t* timestamps,
+    size_t max_messages);
+  size_t notification_count_bridge(void);
+  uint64_t deploy_generation_bridge(void);
+  // the strings peeked are only valid until the next peek or drain, copy them with ffi.string
+  size_t peek_notifications(
+    RimeSessionId* session_ids,
+    const char** message_types,
+    const char** message_values,
+    int64_t* timestamps,
+    size_t max_messages);
   int init_bridge(void);
   void finalize_bridge(void);
+  void wait_jobs_bridge(void);
+  int set_notification_capacity_bridge(size_t capacity);
+  void set_notification_filter_bridge(
+    const char** types, size_t type_count,
+    const RimeSessionId* sessions, size_t session_count,
+    int coalesce);
+  void notification_filter_stats_bridge(uint64_t* filtered, uint64_t* coalesced);
+  int notification_fd_bridge(void);
+  int64_t steady_time_bridge(void);
+  void* task_start_maintenance_bridge(int full_check);
+  void* task_deploy_bridge(void);
+  void* task_deploy_schema_bridge(const char* schema_file);
+  void* task_deploy_config_file_bridge(const char* file_name, const char* version_key);
+  void* task_async_bridge(const char* method, RimeSessionId session_id,
+    const char* arg1, const char* arg2);
+  int task_done_bridge(void* task);
+  int64_t task_value_bridge(void* task);
+  int task_wait_bridge(void* task, double timeout_seconds);
+  int task_fd_bridge(void* task);
+  void task_free_bridge(void* task);
+  int set_concurrency_mode_bridge(int enabled);
+  void deploy_incremental_bridge(const char** files, const char** version_keys,
+    const int* is_schema, size_t count, const char* manifest, int threads, int force,
+    const char* cache, unsigned long long cache_size, int* results);
+  const char* deploy_inputs_bridge(const char* file, const char* version_key, int is_schema);
+  void* watch_open_bridge(const char** dirs, size_t count);
+  const char* watch_wait_bridge(void* w, int debounce_ms, double timeout_seconds, int* overflow);
+  int watch_fd_bridge(void* w);
+  void watch_close_bridge(void* w);
+  void* task_prefetch_bridge(const char* schema_id, int lock);
+  void prefetch_stats_bridge(uint64_t* files, uint64_t* bytes, uint64_t* locked, double* seconds);
+  uint64_t prefetch_unlock_bridge(void);
+  void page_cache_residency_bridge(const char* schema_id, uint64_t* files, uint64_t* bytes,
+    uint64_t* resident);
+  void evict_page_cache_bridge(const char* schema_id, uint64_t* files, uint64_t* bytes,
+    uint64_t* resident);
+  void resource_usage_bridge(uint64_t* rss, uint64_t* max_rss, uint64_t* minor_faults,
+    uint64_t* major_faults);
+  const char* memory_dirs_create_bridge(const char* seed, int* ok);
+  size_t memory_dirs_release_bridge(void);
+  const char* clone_dir_bridge(const char* src, const char* dest, int link_artifacts,
+    uint64_t* counts, double* seconds);
+  const char* warm_up_inputs_bridge(const char* schema_id, size_t count);
+  size_t warm_up_bridge(const char* schema_id, const char** inputs, size_t count,
+    double* seconds, int* candidates, int* committed);
+  int lock_acquire_bridge(int scope, RimeSessionId session_id);
+  void lock_release_bridge(int scope, RimeSessionId session_id);
+  size_t deploy_timings_bridge(int64_t* starts, int64_t* finishes,
+    int* successes, size_t max_runs, int clear);
+  void notification_stats_bridge(size_t* capacity, size_t* pending,
+    uint64_t* dropped, uint64_t* overflowed);
   const char* readline_bridge(const char* prompt, const char** history, int history_count, const char* context, const char* continuation_prompt);
+  int config_load_file_bridge(RimeConfig* config, const char* path);
 ]]
 
 function to_acp_path(path, cp)
@@ -513,7 +580,11 @@ local function NotificationBridge()
   local lib = ffi.load(script_path() .. libname)
   if not lib then error("Failed to load " .. libname) end
   local handle_ptr = ffi.new("void*[1]")
-  local gc_callback = function(_) lib.finalize_bridge() end
+  -- tasks and jobs outlive their collected handles, they finish first
+  local gc_callback = function(_)
+    lib.wait_jobs_bridge()
+    lib.finalize_bridge()
+  end
   ffi.gc(handle_ptr, gc_callback)
   return setmetatable({
     _lib = lib,
@@ -581,27 +652,19 @@ function file_exists(path, cp)
   return false
 end
 -------------------------------------------------------------------------------
-local Set = {}
-Set.__index = Set
-function Set.new() return setmetatable({_data = {}}, Set) end
-function Set:insert(value) self._data[value] = true end
-function Set:erase(value) self._data[value] = nil end
-function Set:find(value) return self._data[value] ~= nil end
-function Set:values()
-  local out = {}
-  for k, _ in pairs(self._data) do out[#out + 1] = k end
-  return out
+-- bumped whenever deployed data may have changed, schema caches compare
+-- their generation against it
+local deploy_generation = 1
+local function bump_deploy_generation() deploy_generation = deploy_generation + 1 end
+-- plus every deploy notification, counted by the bridge before any filter
+local function current_deploy_generation()
+  return deploy_generation + tonumber(bridge.deploy_generation_bridge())
 end
--------------------------------------------------------------------------------
-local cfg_borrowed_set = Set.new()
-local schemalist_borrowed_set = Set.new()
-local function is_config_borrowed(cfg) return cfg and cfg_borrowed_set:find(cfg._c) or false end
-local function is_schemalist_borrowed(schlist) return schlist and schemalist_borrowed_set:find(schlist._c.list) or false end
-local function set_config_borrowed(cfg, borrowed)
-  if not cfg then return end
-  if borrowed then cfg_borrowed_set:insert(cfg._c)
-  else cfg_borrowed_set:erase(cfg._c)
-  end
+-- ownership state is kept on the wrapper object itself (_borrowed), data
+-- borrowed from librime/levers is never closed by us
+local function is_borrowed(obj) return obj and rawget(obj, '_borrowed') == true or false end
+local function set_borrowed(obj, borrowed)
+  if obj then rawset(obj, '_borrowed', borrowed and true or nil) end
 end
 -------------------------------------------------------------------------------
 function RimeTraits()
@@ -996,18 +1059,22 @@ function RimeConfig()
         return function(_, config_id) return api.config_open(tostring(config_id), obj._c) ~= 0 end
       elseif k == 'reload' or k == 'open' then
         return function(_, config_id)
-          local was_borrowed = is_config_borrowed(obj)
+          local was_borrowed = is_borrowed(obj)
           if not was_borrowed then api.config_close(obj._c) end
           local ok = api.config_open(tostring(config_id), obj._c) ~= 0
-          set_config_borrowed(obj, was_borrowed and (not ok))
+          set_borrowed(obj, was_borrowed and (not ok))
           return ok
         end
+      elseif k == 'load_file' then
+        return function(_, path, cp)
+          return bridge.config_load_file_bridge(obj._c, to_acp_path(tostring(path), cp)) ~= 0
+        end
       elseif k == 'close' then
         return function(_)
-          if is_config_borrowed(obj) then return false
+          if is_borrowed(obj) then return false
           else
             local ret = api.config_close(obj._c) ~= 0
-            set_config_borrowed(obj, false)
+            set_borrowed(obj, false)
             return ret
           end
         end
@@ -1019,7 +1086,7 @@ function RimeConfig()
     __newindex = function(_, k, v) error("RimeConfig is read-only") end,
   }
   ffi.gc(obj._c, function(cdata)
-    if not is_config_borrowed(obj) then ensure_api().config_close(cdata) end
+    if not is_borrowed(obj) then ensure_api().config_close(cdata) end
   end)
   setmetatable(obj, mt)
   return obj
@@ -1206,9 +1273,16 @@ function RimeSchemaListItem(ptr)
   return obj
 end
 
+-- _generation: deploy generation of the get_schema_list fill (0 otherwise)
+-- _items: items built since the last fill, callers get a shallow copy
+local function reset_schema_list_cache(schema_list, generation)
+  rawset(schema_list, '_generation', generation or 0)
+  rawset(schema_list, '_items', nil)
+end
+
 function RimeSchemaList()
   local schema_list = ffi.new("RimeSchemaList")
-  local obj = { _c = schema_list }
+  local obj = { _c = schema_list, _generation = 0 }
   local mt = {
     __index = function(_, k)
       if k == 'size' then return tonumber(obj._c.size)
@@ -1216,13 +1290,19 @@ function RimeSchemaList()
         local n = tonumber(obj._c.size) or 0
         local arr = obj._c.list
         if arr == nil or n <= 0 then return {} end
-        local out = {}
-        for i = 0, n - 1 do
-          local ok, item_c = pcall(function() return arr[i] end)
-          if not ok or item_c == nil then break end
-          local item = RimeSchemaListItem(item_c)
-          out[#out + 1] = item
+        local items = rawget(obj, '_items')
+        if items == nil then
+          items = {}
+          for i = 0, n - 1 do
+            local ok, item_c = pcall(function() return arr[i] end)
+            if not ok or item_c == nil then break end
+            local item = RimeSchemaListItem(item_c)
+            items[#items + 1] = item
+          end
+          rawset(obj, '_items', items)
         end
+        local out = {}
+        for i = 1, #items do out[i] = items[i] end
         return out
       elseif k == 'type' then return 'RimeSchemaList'
       end
@@ -1230,7 +1310,9 @@ function RimeSchemaList()
     __newindex = function(_, k, v) error("RimeSchemaList is read-only") end,
   }
   ffi.gc(obj._c, function(cdata)
-    if not is_schemalist_borrowed(obj) then ensure_api().free_schema_list(cdata) end
+    -- lists filled by levers go back to levers
+    if is_borrowed(obj) then get_levers_api().schema_list_destroy(cdata)
+    else ensure_api().free_schema_list(cdata) end
   end)
   setmetatable(obj, mt)
   return obj
@@ -1254,6 +1336,170 @@ if ffi.os == 'Windows' then
   void DeleteCriticalSection(CRITICAL_SECTION* lpCriticalSection);
   ]]
 end
+-- NotificationQueue::kMaxCapacity
+local NOTIFICATION_MAX_CAPACITY = 1048576
+-- handle of an async deploy/maintenance or api:async job in the bridge
+-- kind: 'deploy' (ok, 'success'|'failure'|'skipped'|'unknown'), 'bool' or 'integer'
+local TASK_RESULTS = { [1] = 'success', [2] = 'failure', [3] = 'skipped', [4] = 'unknown' }
+-- concurrency mode: librime calls hold the SessionLocks of the bridge, see
+-- src/session_locks.h for which calls are serialized per session and which
+-- globally. Process-wide, like the locks
+local concurrency_mode = false
+local LOCK_SESSION, LOCK_GLOBAL = 1, 2
+-- work off the Lua thread is serialized by the locks only
+local function require_concurrency_mode(what)
+  if not concurrency_mode then error(what .. ' need concurrency mode, see set_concurrency_mode', 3) end
+end
+local UNLOCKED_CALLS = {
+  get_version = true, is_maintenance_mode = true, join_maintenance_thread = true,
+  find_module = true, get_user_id = true, free_commit = true, free_context = true,
+  free_status = true, candidate_list_next = true, candidate_list_end = true,
+  -- binding side only, the async ones lock on their worker
+  set_notification_handler = true, drain_notifications = true,
+  get_notification_stats = true, get_notification_fd = true,
+  get_deploy_timings = true, get_steady_time = true,
+  set_concurrency_mode = true, get_concurrency_mode = true,
+  start_maintenance_async = true, deploy_async = true, deploy_schema_async = true,
+  deploy_config_file_async = true, async = true, deploy_incremental = true,
+  deploy_inputs = true, watch = true,
+  prefetch = true, get_prefetch_stats = true, prefetch_unlock = true,
+  warm_up = true, get_page_cache_residency = true, evict_page_cache = true,
+  use_memory_dirs = true, release_memory_dirs = true, clone_user_data_dir = true,
+  get_resource_usage = true,
+}
+local SESSION_CALLS = {
+  find_session = true, process_key = true, commit_composition = true,
+  clear_composition = true, get_commit = true, get_status = true, get_context = true,
+  set_option = true, get_option = true, set_property = true, get_property = true,
+  get_current_schema = true, simulate_key_sequence = true, get_input = true,
+  get_caret_pos = true, set_input = true, set_caret_pos = true,
+  select_candidate = true, select_candidate_on_current_page = true,
+  candidate_list_begin = true, candidate_list_from_index = true,
+  delete_candidate = true, delete_candidate_on_current_page = true,
+  highlight_candidate = true, highlight_candidate_on_current_page = true,
+  change_page = true, get_state_label = true, get_state_label_abbreviated = true,
+}
+local function lock_scope(k)
+  if UNLOCKED_CALLS[k] or k:match('^get_.*_dir$') or k:match('^get_.*_dir_s$') then return 0 end
+  return SESSION_CALLS[k] and LOCK_SESSION or LOCK_GLOBAL
+end
+local function release_lock(scope, session_id, ok, ...)
+  if scope ~= 0 then bridge.lock_release_bridge(scope, session_id) end
+  if not ok then error((...), 0) end
+  return ...
+end
+-- the locks are held across fn only, which never calls back into the api
+-- object; session_of maps the first argument to the session to lock
+local function serialized(fn, scope, session_of)
+  return function(self, ...)
+    local session_id = session_of and session_of((...)) or 0
+    return release_lock(bridge.lock_acquire_bridge(scope, session_id), session_id,
+      pcall(fn, self, ...))
+  end
+end
+
+local function RimeTask(ptr, kind)
+  assert(ptr ~= nil, 'failed to start task')
+  local obj = { _c = ffi.gc(ptr, bridge.task_free_bridge) }
+  local function done()
+    if bridge.task_done_bridge(obj._c) == 0 then return false end
+    if kind == 'deploy' and not rawget(obj, '_finished') then
+      rawset(obj, '_finished', true)
+      bump_deploy_generation()
+    end
+    return true
+  end
+  local function result()
+    local value = bridge.task_value_bridge(obj._c)
+    if kind == 'deploy' then
+      local name = TASK_RESULTS[tonumber(value)]
+      return name ~= 'failure', name
+    elseif kind == 'bool' then
+      return value ~= 0
+    end
+    return tonumber(value)
+  end
+  local methods = {
+    done = function(_) return done() end,
+    ready = function(_) return done() end,
+    -- nil while running
+    result = function(_)
+      if not done() then return nil end
+      return result()
+    end,
+    fd = function(_)
+      local fd = bridge.task_fd_bridge(obj._c)
+      return fd >= 0 and fd or nil
+    end,
+    -- blocks outside a coroutine; inside one it yields the task, and the
+    -- caller's scheduler resumes it (once task:fd() polls readable, say)
+    -- until done
+    wait = function(self, timeout)
+      local co, ismain = coroutine.running()
+      if co and not ismain then
+        local deadline = timeout and (tonumber(bridge.steady_time_bridge()) / 1e9 + timeout)
+        while not done() do
+          if deadline and tonumber(bridge.steady_time_bridge()) / 1e9 >= deadline then
+            return nil, 'timeout'
+          end
+          coroutine.yield(self)
+        end
+      elseif bridge.task_wait_bridge(obj._c, timeout or -1) == 0 then
+        return nil, 'timeout'
+      end
+      done()
+      return result()
+    end,
+  }
+  return setmetatable(obj, {
+    __index = function(_, k)
+      if k == 'type' then return 'RimeTask' end
+      return methods[k]
+    end,
+    __newindex = function(_, k, v) error("RimeTask is read-only") end,
+  })
+end
+
+local function split_lines(text)
+  local list = {}
+  for line in text:gmatch('[^\n]+') do list[#list + 1] = line end
+  return list
+end
+
+local function RimeWatcher(ptr)
+  local obj = { _c = ffi.gc(ptr, bridge.watch_close_bridge) }
+  local function check()
+    assert(obj._c ~= nil, 'RimeWatcher already closed')
+    return obj._c
+  end
+  local methods = {
+    -- changed paths, overflow | nil, 'timeout'
+    wait = function(_, debounce_ms, timeout)
+      local overflow = ffi.new('int[1]')
+      local changed = ffi.string(bridge.watch_wait_bridge(check(), tonumber(debounce_ms) or 100,
+        timeout or -1, overflow))
+      if changed == '' and overflow[0] == 0 then return nil, 'timeout' end
+      return split_lines(changed), overflow[0] ~= 0
+    end,
+    fd = function(_)
+      local fd = bridge.watch_fd_bridge(check())
+      return fd >= 0 and fd or nil
+    end,
+    close = function(_)
+      if obj._c == nil then return end
+      bridge.watch_close_bridge(ffi.gc(obj._c, nil))
+      rawset(obj, '_c', nil)
+    end,
+  }
+  return setmetatable(obj, {
+    __index = function(_, k)
+      if k == 'type' then return 'RimeWatcher' end
+      return methods[k]
+    end,
+    __newindex = function(_, k, v) error("RimeWatcher is read-only") end,
+  })
+end
+
 function RimeApi()
   local tosessionid = function(session_id)
     if type(session_id) == 'number' then
@@ -1267,6 +1513,20 @@ function RimeApi()
     end
   end
 
+  -- arrays handed to the bridge, grown to the pending count and reused
+  local noti_buf = { size = 0 }
+  local function notification_buffers(count)
+    if count > noti_buf.size then
+      local size = math.max(count, noti_buf.size * 2, 64)
+      noti_buf.ids = ffi.new("RimeSessionId[?]", size)
+      noti_buf.types = ffi.new("const char*[?]", size)
+      noti_buf.values = ffi.new("const char*[?]", size)
+      noti_buf.stamps = ffi.new("int64_t[?]", size)
+      noti_buf.size = size
+    end
+    return noti_buf
+  end
+
   local obj = { _c = ensure_api(), _notifications_handler = nil}
   local mt = {
     __index = function(_, k)
@@ -1278,7 +1538,7 @@ function RimeApi()
           return nil
         end
       elseif k == 'set_notification_handler' then
-        return function(_, handler_func, context_object)
+        return function(_, handler_func, capacity)
           if type(handler_func) ~= 'function' then
             local ok, err = xpcall(function()
               obj:drain_notifications()
@@ -1286,29 +1546,78 @@ function RimeApi()
             end, debug.traceback)
             if not ok then print("Error while finalizing bridge: " .. tostring(err)) end
             obj._notifications_handler = nil
-            return nil
+            return true
           end
+          -- capacity or { capacity =, batch =, types =, sessions =, coalesce = }
+          local batch, opts = false, nil
+          if type(capacity) == 'table' then
+            opts = capacity
+            batch = opts.batch and true or false
+            capacity = opts.capacity
+          end
+          if capacity ~= nil then
+            assert(type(capacity) == 'number' and capacity >= 0 and capacity <= NOTIFICATION_MAX_CAPACITY,
+              'capacity out of range')
+            -- refused while a deploy may be notifying, nothing changes then
+            if capacity > 0 and bridge.set_notification_capacity_bridge(capacity) == 0 then
+              return false, 'capacity can not change during maintenance or a running task'
+            end
+          end
+          local types, sessions = opts and opts.types or {}, opts and opts.sessions or {}
+          assert(type(types) == 'table', 'types must be a list of strings')
+          assert(type(sessions) == 'table', 'sessions must be a list of RimeSession or integer')
+          local type_arr = ffi.new("const char*[?]", #types + 1)
+          for i, t in ipairs(types) do
+            assert(type(t) == 'string', 'types must be a list of strings')
+            type_arr[i - 1] = t -- anchored by opts.types during the call
+          end
+          local session_arr = ffi.new("RimeSessionId[?]", #sessions + 1)
+          for i, sid in ipairs(sessions) do session_arr[i - 1] = tosessionid(sid) end
+          bridge.set_notification_filter_bridge(type_arr, #types, session_arr, #sessions,
+            (opts and opts.coalesce) and 1 or 0)
           bridge.init_bridge()
           obj._notifications_handler = handler_func
-          return nil
+          rawset(obj, '_notifications_batch', batch)
+          return true
         end
       elseif k == 'drain_notifications' then
         return function(_)
-          -- use bridge.drain_notifications to drain notifications
-          local MAX_MESSAGES = 1000
-          local ids = ffi.new("RimeSessionId[?]", MAX_MESSAGES)
-          local types = ffi.new("const char*[?]", MAX_MESSAGES)
-          local values = ffi.new("const char*[?]", MAX_MESSAGES)
-          local count = tonumber(bridge.drain_notifications(ids, types, values, MAX_MESSAGES))
+          -- size the arrays by the pending count, the strings are owned by
+          -- the bridge until the next drain
+          local pending = tonumber(bridge.notification_count_bridge())
+          if pending <= 0 then return nil end
+          local buf = notification_buffers(pending)
+          local ids, types, values, stamps = buf.ids, buf.types, buf.values, buf.stamps
+          local count = tonumber(bridge.drain_notifications_timed(ids, types, values, stamps, pending))
           if count <= 0 then return nil end
+          local handler = obj._notifications_handler
           -- protected call to notification handler
           local ok, err = xpcall(function()
+            if rawget(obj, '_notifications_batch') then
+              -- one call per drain: handler(nil, { {session, type, value, timestamp}, ... })
+              local records, sessions = {}, {}
+              for i = 0, count - 1 do
+                local ntype = safestr(types[i]) or ''
+                local key = tonumber(ids[i])
+                local session = sessions[key]
+                if not session then
+                  session = RimeSession(ids[i])
+                  sessions[key] = session
+                end
+                records[i + 1] = {
+                  session = session, type = ntype, value = safestr(values[i]) or '',
+                  timestamp = tonumber(stamps[i]) / 1e9,
+                }
+              end
+              if type(handler) == 'function' then handler(nil, records) end
+              return
+            end
             for i = 0, count - 1 do
               local session_id = RimeSession(ids[i])
               local ntype = safestr(types[i]) or ''
               local nvalue = safestr(values[i]) or ''
-              if type(obj._notifications_handler) == 'function' then
-                local _ok, res = pcall(obj._notifications_handler, nil, session_id, ntype, nvalue)
+              if type(handler) == 'function' then
+                local _ok, res = pcall(handler, nil, session_id, ntype, nvalue, tonumber(stamps[i]) / 1e9)
                 if not _ok then print("Error in notification handler: " .. tostring(res)) end
               end
             end
@@ -1316,21 +1625,226 @@ function RimeApi()
           if not ok then print("Error while draining notifications: " .. tostring(err)) end
           return nil
         end
+      elseif k == 'start_maintenance_async' then
+        return function(_, full_check)
+          require_concurrency_mode('deploy tasks')
+          return RimeTask(bridge.task_start_maintenance_bridge(full_check and 1 or 0), 'deploy')
+        end
+      elseif k == 'deploy_async' then
+        return function(_)
+          require_concurrency_mode('deploy tasks')
+          return RimeTask(bridge.task_deploy_bridge(), 'deploy')
+        end
+      elseif k == 'deploy_schema_async' then
+        return function(_, schema_file)
+          require_concurrency_mode('deploy tasks')
+          return RimeTask(bridge.task_deploy_schema_bridge(tostring(schema_file)), 'deploy')
+        end
+      elseif k == 'deploy_config_file_async' then
+        return function(_, file_name, version_key)
+          require_concurrency_mode('deploy tasks')
+          return RimeTask(bridge.task_deploy_config_file_bridge(tostring(file_name), tostring(version_key)), 'deploy')
+        end
+      elseif k == 'deploy_incremental' then
+        return function(_, items, opts)
+          assert(type(items) == 'table', 'items must be a list')
+          opts = opts or {}
+          local n = #items
+          local files = ffi.new("const char*[?]", n + 1)
+          local keys = ffi.new("const char*[?]", n + 1)
+          local schemas = ffi.new("int[?]", n + 1)
+          local results = ffi.new("int[?]", n + 1)
+          local names, anchors = {}, {}
+          for i, item in ipairs(items) do
+            local file, key = item, 'config_version'
+            if type(item) == 'table' then file, key = item.file, tostring(item.version_key or key) end
+            assert(type(file) == 'string', 'items must be strings or { file=, version_key= }')
+            names[i], anchors[i] = file, key
+            files[i - 1], keys[i - 1] = file, key
+            schemas[i - 1] = file:match('%.schema%.yaml$') and 1 or 0
+          end
+          bridge.deploy_incremental_bridge(files, keys, schemas, n, opts.manifest,
+            tonumber(opts.threads) or 0, opts.force and 1 or 0, opts.cache,
+            math.max(0, tonumber(opts.cache_size) or 0), results)
+          bump_deploy_generation()
+          local out = { skipped = {}, deployed = {}, failed = {}, restored = {} }
+          local lists = { [0] = out.skipped, out.deployed, out.failed, out.restored }
+          for i = 1, n do
+            local list = lists[results[i - 1]]
+            list[#list + 1] = names[i]
+          end
+          return out
+        end
+      elseif k == 'deploy_inputs' then
+        return function(_, file, version_key)
+          assert(type(file) == 'string', 'file must be a string')
+          local inputs = bridge.deploy_inputs_bridge(file, version_key or 'config_version',
+            file:match('%.schema%.yaml$') and 1 or 0)
+          return split_lines(ffi.string(inputs))
+        end
+      elseif k == 'get_resource_usage' then
+        return function(_)
+          local v = ffi.new('uint64_t[4]')
+          bridge.resource_usage_bridge(v, v + 1, v + 2, v + 3)
+          return { rss = tonumber(v[0]), max_rss = tonumber(v[1]), minor_faults = tonumber(v[2]),
+            major_faults = tonumber(v[3]) }
+        end
+      elseif k == 'use_memory_dirs' then
+        return function(_, traits, seed_dir)
+          local ok = ffi.new('int[1]')
+          local result = ffi.string(bridge.memory_dirs_create_bridge(seed_dir, ok))
+          if ok[0] == 0 then return nil, result end
+          local dirs = split_lines(result)
+          traits.user_data_dir, traits.staging_dir, traits.log_dir = dirs[2], dirs[3], dirs[4]
+          return dirs[1]
+        end
+      elseif k == 'release_memory_dirs' then
+        return function(_) return tonumber(bridge.memory_dirs_release_bridge()) end
+      elseif k == 'clone_user_data_dir' then
+        return function(_, src, dest, link_artifacts)
+          assert(type(src) == 'string' and type(dest) == 'string', 'dirs must be strings')
+          local counts, seconds = ffi.new('uint64_t[5]'), ffi.new('double[1]')
+          local err = bridge.clone_dir_bridge(src, dest, link_artifacts == false and 0 or 1, counts, seconds)
+          if err ~= nil then return nil, ffi.string(err) end
+          return { files = tonumber(counts[0]), cloned = tonumber(counts[1]), linked = tonumber(counts[2]),
+            copied = tonumber(counts[3]), bytes_copied = tonumber(counts[4]), seconds = seconds[0] }
+        end
+      elseif k == 'watch' then
+        return function(_, dirs)
+          assert(type(dirs) == 'table', 'dirs must be a list')
+          local list = ffi.new("const char*[?]", #dirs + 1)
+          for i, dir in ipairs(dirs) do list[i - 1] = tostring(dir) end
+          local ptr = bridge.watch_open_bridge(list, #dirs)
+          if ptr == nil then return nil, 'no directory could be watched' end
+          return RimeWatcher(ptr)
+        end
+      elseif k == 'prefetch' then
+        return function(_, schema_id, lock)
+          return RimeTask(bridge.task_prefetch_bridge(tostring(schema_id), lock and 1 or 0), 'integer')
+        end
+      elseif k == 'get_prefetch_stats' then
+        return function(_)
+          local files, bytes, locked = ffi.new('uint64_t[1]'), ffi.new('uint64_t[1]'), ffi.new('uint64_t[1]')
+          local seconds = ffi.new('double[1]')
+          bridge.prefetch_stats_bridge(files, bytes, locked, seconds)
+          return { files = tonumber(files[0]), bytes = tonumber(bytes[0]),
+            locked = tonumber(locked[0]), seconds = tonumber(seconds[0]) }
+        end
+      elseif k == 'prefetch_unlock' then
+        return function(_) return tonumber(bridge.prefetch_unlock_bridge()) end
+      elseif k == 'get_page_cache_residency' then
+        return function(_, schema_id)
+          local files, bytes, resident = ffi.new('uint64_t[1]'), ffi.new('uint64_t[1]'), ffi.new('uint64_t[1]')
+          bridge.page_cache_residency_bridge(tostring(schema_id), files, bytes, resident)
+          return { files = tonumber(files[0]), bytes = tonumber(bytes[0]), resident = tonumber(resident[0]) }
+        end
+      elseif k == 'evict_page_cache' then
+        return function(_, schema_id)
+          local files, bytes, resident = ffi.new('uint64_t[1]'), ffi.new('uint64_t[1]'), ffi.new('uint64_t[1]')
+          bridge.evict_page_cache_bridge(tostring(schema_id), files, bytes, resident)
+          return { files = tonumber(files[0]), bytes = tonumber(bytes[0]), resident = tonumber(resident[0]) }
+        end
+      elseif k == 'warm_up' then
+        return function(_, schema_id, inputs)
+          schema_id = tostring(schema_id)
+          if type(inputs) ~= 'table' then
+            inputs = split_lines(ffi.string(bridge.warm_up_inputs_bridge(schema_id, tonumber(inputs) or 50)))
+          end
+          local n = #inputs
+          local list = ffi.new("const char*[?]", n + 1)
+          for i, input in ipairs(inputs) do
+            assert(type(input) == 'string', 'inputs must be strings')
+            list[i - 1] = input
+          end
+          local seconds, candidates = ffi.new("double[?]", n + 1), ffi.new("int[?]", n + 1)
+          local committed = ffi.new("int[?]", n + 1)
+          local samples = {}
+          for i = 1, tonumber(bridge.warm_up_bridge(schema_id, list, n, seconds, candidates, committed)) do
+            samples[i] = { input = inputs[i], seconds = seconds[i - 1], candidates = candidates[i - 1],
+              committed = committed[i - 1] ~= 0 }
+          end
+          return samples
+        end
+      elseif k == 'async' then
+        -- api:async(method, ...), see task_async_bridge for the methods
+        return function(_, method, ...)
+          require_concurrency_mode('async calls')
+          local session_id, arg1, arg2 = 0, ...
+          if method == 'select_schema' then
+            session_id, arg1 = tosessionid((...)), select(2, ...)
+          elseif method ~= 'sync_user_data' and method ~= 'backup_user_dict'
+            and method ~= 'export_user_dict' and method ~= 'import_user_dict' then
+            error("unsupported method for async: " .. tostring(method))
+          end
+          local kind = (method == 'export_user_dict' or method == 'import_user_dict') and 'integer' or 'bool'
+          return RimeTask(bridge.task_async_bridge(method, session_id,
+            arg1 and tostring(arg1) or nil, arg2 and tostring(arg2) or nil), kind)
+        end
+      elseif k == 'get_steady_time' then
+        return function(_) return tonumber(bridge.steady_time_bridge()) / 1e9 end
+      elseif k == 'set_concurrency_mode' then
+        return function(_, enabled)
+          concurrency_mode = enabled and true or false
+          return bridge.set_concurrency_mode_bridge(concurrency_mode and 1 or 0) ~= 0
+        end
+      elseif k == 'get_concurrency_mode' then
+        return function(_) return concurrency_mode end
+      elseif k == 'get_deploy_timings' then
+        return function(_, clear)
+          local MAX_RUNS = 64 -- DeployTimer::kMaxRuns
+          local starts = ffi.new("int64_t[?]", MAX_RUNS)
+          local finishes = ffi.new("int64_t[?]", MAX_RUNS)
+          local successes = ffi.new("int[?]", MAX_RUNS)
+          local count = tonumber(bridge.deploy_timings_bridge(starts, finishes, successes, MAX_RUNS, clear and 1 or 0))
+          local runs = {}
+          for i = 0, count - 1 do
+            local start, finish = tonumber(starts[i]) / 1e9, tonumber(finishes[i]) / 1e9
+            runs[#runs + 1] = {
+              start = start, finish = finish, duration = finish - start,
+              result = successes[i] ~= 0 and 'success' or 'failure',
+            }
+          end
+          return runs
+        end
+      elseif k == 'get_notification_fd' then
+        return function(_)
+          local fd = bridge.notification_fd_bridge()
+          return fd >= 0 and fd or nil
+        end
+      elseif k == 'get_notification_stats' then
+        return function(_)
+          local cap = ffi.new("size_t[1]")
+          local pending = ffi.new("size_t[1]")
+          local dropped = ffi.new("uint64_t[1]")
+          local overflowed = ffi.new("uint64_t[1]")
+          local filtered = ffi.new("uint64_t[1]")
+          local coalesced = ffi.new("uint64_t[1]")
+          bridge.notification_stats_bridge(cap, pending, dropped, overflowed)
+          bridge.notification_filter_stats_bridge(filtered, coalesced)
+          return {
+            capacity = tonumber(cap[0]), pending = tonumber(pending[0]),
+            dropped = tonumber(dropped[0]), overflowed = tonumber(overflowed[0]),
+            filtered = tonumber(filtered[0]), coalesced = tonumber(coalesced[0]),
+          }
+        end
       elseif k == 'is_maintenance_mode' then
         return function() return tonumber(obj._c.is_maintenance_mode()) end
       elseif k == 'start_maintenance' then
         return function(_, full_check)
           local res = obj._c.start_maintenance(full_check and 1 or 0)
+          bump_deploy_generation()
           return tonumber(res)
         end
       elseif k == 'join_maintenance_thread' then
         return function(_)
           obj._c.join_maintenance_thread()
+          bump_deploy_generation()
           return nil
         end
       elseif k == 'initialize' then
         return function(_, traits)
           obj._c.initialize(traits._c)
+          bump_deploy_generation()
           return nil
         end
       elseif k == 'finalize' then
@@ -1359,9 +1873,22 @@ function RimeApi()
       elseif k == 'get_status' then
         return function(_, session_id, status_obj) return obj._c.get_status(tosessionid(session_id), status_obj._c) ~= 0 end
       elseif k == 'get_schema_list' then
-        return function(_, schemas) return obj._c.get_schema_list(schemas._c) ~= 0 end
+        return function(_, schemas)
+          -- the list is only refilled after a deploy or select_schemas
+          if schemas._c.list ~= nil and schemas._generation == current_deploy_generation() then return true end
+          if is_borrowed(schemas) then get_levers_api().schema_list_destroy(schemas._c)
+          else obj._c.free_schema_list(schemas._c) end
+          set_borrowed(schemas, false)
+          local generation = current_deploy_generation()
+          local ok = obj._c.get_schema_list(schemas._c) ~= 0
+          reset_schema_list_cache(schemas, (ok and obj._c.is_maintenance_mode() == 0) and generation or 0)
+          return ok
+        end
       elseif k == 'free_schema_list' then
-        return function(_, schemas) obj._c.free_schema_list(schemas._c) end
+        return function(_, schemas)
+          obj._c.free_schema_list(schemas._c)
+          reset_schema_list_cache(schemas)
+        end
       elseif k == 'get_context' then
         return function(_, session_id, context_obj) return obj._c.get_context(tosessionid(session_id), context_obj._c) ~= 0 end
       elseif k == 'free_commit' then
@@ -1399,21 +1926,25 @@ function RimeApi()
       elseif k == 'prebuild' then
         return function(_)
           local ok = obj._c.prebuild() ~= 0
+          bump_deploy_generation()
           return ok
         end
       elseif k == 'deploy' then
         return function(_)
           local ok = obj._c.deploy() ~= 0
+          bump_deploy_generation()
           return ok
         end
       elseif k == 'deploy_schema' then
         return function(_, schema_file)
           local ok = obj._c.deploy_schema(tostring(schema_file)) ~= 0
+          bump_deploy_generation()
           return ok
         end
       elseif k == 'deploy_config_file' then
         return function(_, file_name, version_key)
           local ok = obj._c.deploy_config_file(tostring(file_name), tostring(version_key)) ~= 0
+          bump_deploy_generation()
           return ok
         end
       elseif k == 'sync_user_data' then
@@ -1444,27 +1975,26 @@ function RimeApi()
         end
       elseif k == 'config_open' then
         return function(_, config_id, config_obj)
-          local was_borrowed = is_config_borrowed(config_obj)
+          local was_borrowed = is_borrowed(config_obj)
           if not was_borrowed then obj._c.config_close(config_obj._c) end
           local ret = obj._c.config_open(tostring(config_id), config_obj._c) ~= 0
-          set_config_borrowed(config_obj, was_borrowed and (not ret))
+          set_borrowed(config_obj, was_borrowed and (not ret))
           return ret
         end
       elseif k == 'config_close' then
         return function(_, config_obj)
           local ret = false
-          if not is_config_borrowed(config_obj) then
+          if not is_borrowed(config_obj) then
             ret = obj._c.config_close(config_obj._c) ~= 0
-            cfg_borrowed_set:erase(config_obj)
           end
           return ret
         end
       elseif k == 'schema_open' then
         return function(_, schema_id, config_obj)
-          local was_borrowed = is_config_borrowed(config_obj)
+          local was_borrowed = is_borrowed(config_obj)
           if not was_borrowed then obj._c.config_close(config_obj._c) end
           local ret = obj._c.schema_open(tostring(schema_id), config_obj._c) ~= 0
-          set_config_borrowed(config_obj, was_borrowed and (not ret))
+          set_borrowed(config_obj, was_borrowed and (not ret))
           return ret
         end
       elseif k == 'select_schema' then
@@ -1647,10 +2177,10 @@ function RimeApi()
         return function(_) return safestr(obj._c.get_version()) end
       elseif k == 'user_config_open' then
         return function(_, config_id, config_obj)
-          local was_borrowed = is_config_borrowed(config_obj)
+          local was_borrowed = is_borrowed(config_obj)
           if not was_borrowed then obj._c.config_close(config_obj._c) end
           local ret = obj._c.user_config_open(tostring(config_id), config_obj._c) ~= 0
-          set_config_borrowed(config_obj, was_borrowed and (not ret))
+          set_borrowed(config_obj, was_borrowed and (not ret))
           return ret
         end
       elseif k == 'type' then return 'RimeApi'
@@ -1663,6 +2193,15 @@ function RimeApi()
       else error("RimeApi is read-only") end
     end,
   }
+  local index = mt.__index
+  mt.__index = function(t, k)
+    local v = index(t, k)
+    if concurrency_mode and type(v) == 'function' then
+      local scope = lock_scope(k)
+      if scope ~= 0 then return serialized(v, scope, scope == LOCK_SESSION and tosessionid or nil) end
+    end
+    return v
+  end
   setmetatable(obj, mt)
   return obj
 end
@@ -1679,6 +2218,120 @@ function RimeUserDictIterator()
   return {_c = ffi.new("RimeUserDictIterator"), type = 'RimeUserDictIterator' }
 end
 
+-- schema catalog: every RimeSchemaInfo field read once, kept until
+-- deploy_generation moves on
+local catalog, catalog_generation = nil, 0
+local CATALOG_FIELDS = { 'schema_id', 'name', 'version', 'author', 'description', 'file_path' }
+
+local function load_schema_catalog(levers)
+  local settings = levers.switcher_settings_init()
+  if settings == nil then return nil end
+  local custom = ffi.cast("RimeCustomSettings*", settings)
+  levers.load_settings(custom)
+  local list = ffi.new("RimeSchemaList")
+  local records
+  if levers.get_available_schema_list(settings, list) ~= 0 then
+    records = {}
+    for i = 0, tonumber(list.size) - 1 do
+      local item = list.list[i]
+      local info = ffi.cast("RimeSchemaInfo*", item.reserved)
+      local r = { schema_id = safestr(item.schema_id), name = safestr(item.name) }
+      if info ~= nil then
+        r.version = safestr(levers.get_schema_version(info))
+        r.author = safestr(levers.get_schema_author(info))
+        r.description = safestr(levers.get_schema_description(info))
+        r.file_path = safestr(levers.get_schema_file_path(info))
+      end
+      records[#records + 1] = r
+    end
+    levers.schema_list_destroy(list)
+  end
+  levers.custom_settings_destroy(custom)
+  return records
+end
+
+-- customize_batch helpers: collect and validate everything before applying
+local MAX_BATCH_DEPTH = 32
+local function is_sequence(t)
+  local len = #t
+  if len == 0 then return false end
+  local count = 0
+  for _ in pairs(t) do count = count + 1 end
+  return count == len
+end
+
+-- LuaJIT has no integer subtype, integral numbers in int range count as int
+local function is_int_value(v)
+  return v == math.floor(v) and v >= -2147483648 and v <= 2147483647
+end
+
+local function is_config_obj(v)
+  return type(v) == 'table' and v.type == 'RimeConfig'
+end
+
+local function fill_config(cfg, path, value, depth)
+  local c = ensure_api()
+  local vt = type(value)
+  if vt == 'boolean' then return c.config_set_bool(cfg._c, path, value and 1 or 0) ~= 0
+  elseif vt == 'number' then
+    if is_int_value(value) then
+      return c.config_set_int(cfg._c, path, value) ~= 0
+    end
+    return c.config_set_double(cfg._c, path, value) ~= 0
+  elseif vt == 'string' then return c.config_set_string(cfg._c, path, value) ~= 0
+  elseif is_config_obj(value) then return c.config_set_item(cfg._c, path, value._c) ~= 0
+  elseif vt == 'table' then
+    if depth > MAX_BATCH_DEPTH then return false, 'table nested too deep at ' .. path end
+    if is_sequence(value) then
+      if c.config_create_list(cfg._c, path) == 0 then return false end
+      for i, v in ipairs(value) do
+        local ok, err = fill_config(cfg, path .. '/@' .. (i - 1), v, depth + 1)
+        if not ok then return false, err end
+      end
+      return true
+    end
+    if c.config_create_map(cfg._c, path) == 0 then return false end
+    for k, v in pairs(value) do
+      if type(k) ~= 'string' then return false, 'non-string key in map at ' .. path end
+      local ok, err = fill_config(cfg, path .. '/' .. k, v, depth + 1)
+      if not ok then return false, err end
+    end
+    return true
+  end
+  return false, 'unsupported value type ' .. vt .. ' at ' .. path
+end
+
+local function collect_customize_entries(tbl, prefix, depth, entries)
+  if depth > MAX_BATCH_DEPTH then return false, 'table nested too deep at ' .. prefix end
+  for k, v in pairs(tbl) do
+    if type(k) ~= 'string' then
+      return false, 'customize_batch expects string keys' .. (prefix ~= '' and (' at ' .. prefix) or '')
+    end
+    local key = prefix == '' and k or (prefix .. '/' .. k)
+    local vt = type(v)
+    if vt == 'table' and not is_config_obj(v) and not is_sequence(v) then
+      local ok, err = collect_customize_entries(v, key, depth + 1, entries)
+      if not ok then return false, err end
+    elseif vt == 'boolean' or vt == 'string' then
+      entries[#entries + 1] = { key = key, kind = vt, value = v }
+    elseif vt == 'number' then
+      entries[#entries + 1] = { key = key, kind = is_int_value(v) and 'int' or 'double', value = v }
+    elseif is_config_obj(v) then
+      entries[#entries + 1] = { key = key, kind = 'item', value = v }
+    elseif vt == 'table' then
+      local tmp, item = RimeConfig(), RimeConfig()
+      local ok, err = ensure_api().config_init(tmp._c) ~= 0
+      if ok then ok, err = fill_config(tmp, 'value', v, depth + 1) end
+      if ok then ok = ensure_api().config_get_item(tmp._c, 'value', item._c) ~= 0 end
+      if not ok then return false, err or ('failed to build list at ' .. key) end
+      entries[#entries + 1] = { key = key, kind = 'item', value = item }
+    else
+      return false, 'unsupported value type ' .. vt .. ' at ' .. key
+    end
+  end
+  return true
+end
+
 local function wrap_levers_api(get_pointer)
   local function ensure_levers()
     local ptr = get_pointer()
@@ -1736,9 +2389,59 @@ local function wrap_levers_api(get_pointer)
         return function(_, settings, key, value_obj)
           return ensure_levers().customize_item(settings._c, tostring(key), value_obj._c) ~= 0
         end
+      elseif k == 'customize_batch' then
+        return function(_, settings, tbl)
+          assert(type(tbl) == 'table', 'customize_batch expects a table')
+          local levers = ensure_levers()
+          local entries = {}
+          local ok, err = collect_customize_entries(tbl, '', 0, entries)
+          if not ok then return false, err end
+          for _, e in ipairs(entries) do
+            local ret
+            if e.kind == 'boolean' then ret = levers.customize_bool(settings._c, e.key, e.value and 1 or 0)
+            elseif e.kind == 'int' then ret = levers.customize_int(settings._c, e.key, e.value)
+            elseif e.kind == 'double' then ret = levers.customize_double(settings._c, e.key, e.value)
+            elseif e.kind == 'string' then ret = levers.customize_string(settings._c, e.key, e.value)
+            else ret = levers.customize_item(settings._c, e.key, e.value._c) end
+            if ret == 0 then
+              -- drop the partially applied patch; unsaved changes made
+              -- before the call go too, levers cannot unset a patch key
+              levers.load_settings(settings._c)
+              return false, 'failed to customize ' .. e.key .. ', unsaved settings reloaded from disk'
+            end
+          end
+          if levers.settings_is_modified(settings._c) ~= 0 then
+            local saved = levers.save_settings(settings._c) ~= 0
+            bump_deploy_generation()
+            return saved
+          end
+          return true
+        end
+      elseif k == 'get_schema_catalog' then
+        return function(_)
+          local generation = current_deploy_generation()
+          if catalog_generation ~= generation then
+            local records = load_schema_catalog(ensure_levers())
+            if records == nil then return nil end
+            catalog = records
+            -- results read while maintenance is running are not kept
+            catalog_generation = ensure_api().is_maintenance_mode() ~= 0 and 0 or generation
+          end
+          local out = {}
+          for i, r in ipairs(catalog) do
+            local copy = {}
+            for _, f in ipairs(CATALOG_FIELDS) do
+              if r[f] ~= nil and r[f] ~= '' then copy[f] = r[f] end
+            end
+            out[i] = copy
+          end
+          return out
+        end
       elseif k == 'save_settings' then
         return function(_, settings)
-          return ensure_levers().save_settings(settings._c) ~= 0
+          local ok = ensure_levers().save_settings(settings._c) ~= 0
+          bump_deploy_generation()
+          return ok
         end
       elseif k == 'custom_settings_destroy' then
         return function(_, settings)
@@ -1754,7 +2457,8 @@ local function wrap_levers_api(get_pointer)
       elseif k == 'get_available_schema_list' then
         return function(_, switcher_settings, schema_list)
           local ret = ensure_levers().get_available_schema_list(switcher_settings._c, schema_list._c) ~= 0
-          if ret then schemalist_borrowed_set:insert(schema_list) end
+          if ret then set_borrowed(schema_list, true) end
+          reset_schema_list_cache(schema_list)
           return ret
         end
       elseif k == 'settings_is_modified' then
@@ -1764,7 +2468,7 @@ local function wrap_levers_api(get_pointer)
       elseif k == 'settings_get_config' then
         return function(_, switcher_settings, config_obj)
           local ret = ensure_levers().settings_get_config(switcher_settings._c, config_obj._c) ~= 0
-          if ret then set_config_borrowed(config_obj, true) end
+          if ret then set_borrowed(config_obj, true) end
           return ret
         end
       elseif k == 'user_dict_iterator_init' then
@@ -1823,7 +2527,8 @@ local function wrap_levers_api(get_pointer)
       elseif k == 'get_selected_schema_list' then
         return function(_, switcher_settings, schema_list)
           local ret = ensure_levers().get_selected_schema_list(switcher_settings._c, schema_list._c) ~= 0
-          if ret then schemalist_borrowed_set:insert(schema_list) end
+          if ret then set_borrowed(schema_list, true) end
+          reset_schema_list_cache(schema_list)
           return ret
         end
       elseif k == 'select_schemas' then
@@ -1831,7 +2536,9 @@ local function wrap_levers_api(get_pointer)
           local count = tonumber(array_size)
           local schema_id_array_c = ffi.new("const char*[?]", count)
           for i = 0, count - 1 do schema_id_array_c[i] = tostring(schema_id_array[i + 1]) end
-          return ensure_levers().select_schemas(switcher_settings._c, schema_id_array_c, count) ~= 0
+          local ok = ensure_levers().select_schemas(switcher_settings._c, schema_id_array_c, count) ~= 0
+          bump_deploy_generation()
+          return ok
         end
       elseif k == 'get_hotkeys' then
         return function(_, switcher_settings)
@@ -1844,6 +2551,7 @@ local function wrap_levers_api(get_pointer)
       elseif k == 'schema_list_destroy' then
         return function(_, schema_list)
           ensure_levers().schema_list_destroy(schema_list._c)
+          reset_schema_list_cache(schema_list)
           return nil
         end
       else
@@ -1852,6 +2560,12 @@ local function wrap_levers_api(get_pointer)
     end,
     __newindex = function(_, k, v) error("RimeLeversApi is read-only") end,
   }
+  local index = mt.__index
+  mt.__index = function(t, k)
+    local v = index(t, k)
+    if concurrency_mode and type(v) == 'function' then return serialized(v, LOCK_GLOBAL) end
+    return v
+  end
   return setmetatable(obj, mt)
 end
 
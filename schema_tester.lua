@@ -93,6 +93,18 @@ config.log_dir = resolve_config_path(config.log_dir, 'log')
 print('Using shared_data_dir: ' .. tostring(config.shared_data_dir))
 print('Using user_data_dir: ' .. tostring(config.user_data_dir))
 print('Using log_dir: ' .. tostring(config.log_dir))
+if config.artifact_cache then
+  local path = config.artifact_cache
+  local absolute = path:sub(1,1) == '/' or path:sub(2,2) == ':'
+  config.artifact_cache = absolute and path or (exec_dir .. div .. path)
+  print('Using artifact_cache: ' .. config.artifact_cache)
+end
+if type(config.memory_dirs) == 'string' then
+  local path = config.memory_dirs
+  local absolute = path:sub(1,1) == '/' or path:sub(2,2) == ':'
+  config.memory_dirs = absolute and path or (exec_dir .. div .. path)
+  print('Using memory_dirs seeded from: ' .. config.memory_dirs)
+end
 print('Using schema_id: ' .. tostring(config.schema_id or 'luna_pinyin'))
 print()
 -------------------------------------------------------------------------------
@@ -145,13 +157,45 @@ local traits = RimeTraits()
 local session = nil
 
 -------------------------------------------------------------------------------
+-- the schema under test goes through the artifact cache before the
+-- maintenance, which then finds its dictionaries compiled
+local function restore_artifacts()
+  if not config.artifact_cache then return end
+  local schema_file = traits.user_data_dir .. div .. schema_id .. '.schema.yaml'
+  if not file_exists(schema_file) then
+    schema_file = traits.shared_data_dir .. div .. schema_id .. '.schema.yaml'
+  end
+  local r = rime_api:deploy_incremental({ schema_file }, {
+    cache = config.artifact_cache,
+    cache_size = math.floor((config.artifact_cache_size or 0) * 1024 * 1024),
+  })
+  if #r.restored > 0 then print('Restored compiled dictionaries from ' .. config.artifact_cache) end
+end
 local function init_session()
   rime_api:initialize(traits)
+  restore_artifacts()
   if rime_api:start_maintenance(true) then rime_api:join_maintenance_thread() end
   session = rime_api:create_session()
   assert_exit(session ~= nil)
   assert_exit(rime_api:select_schema(session, schema_id) == true,
     "Failed to select schema: " .. tostring(schema_id))
+  if config.prefetch then
+    rime_api:prefetch(schema_id, config.prefetch == 'lock'):wait()
+    local stats = rime_api:get_prefetch_stats()
+    print(string.format('Prefetched %d files, %d bytes in %.1f ms', stats.files, stats.bytes,
+      stats.seconds * 1000))
+  end
+  if config.warm_up then
+    local samples = rime_api:warm_up(schema_id, config.warm_up ~= true and config.warm_up or nil)
+    local total, slowest = 0, 0
+    for _, sample in ipairs(samples) do
+      total = total + sample.seconds
+      slowest = math.max(slowest, sample.seconds)
+    end
+    print(string.format('Warmed up with %d inputs: %.2f ms mean, %.2f ms max, last %.2f ms', #samples,
+      #samples > 0 and total / #samples * 1000 or 0, slowest * 1000,
+      #samples > 0 and samples[#samples].seconds * 1000 or 0))
+  end
 end
 -------------------------------------------------------------------------------
 local function init()
@@ -163,7 +207,12 @@ local function init()
   traits.distribution_code_name = "rimeapi"
   traits.distribution_version = "1.0.0"
   traits.log_dir = config.log_dir or (script_path() .. "log")
-  if not os.mkdir then
+  if config.memory_dirs then
+    local seed = type(config.memory_dirs) == 'string' and config.memory_dirs or nil
+    local root, err = rime_api:use_memory_dirs(traits, seed)
+    assert_exit(root, 'Failed to create memory dirs: ' .. tostring(err))
+    print('Using memory dirs: ' .. root)
+  elseif not os.mkdir then
     -- check system is windows or unix-like
     local is_windows = package.config:sub(1, 1) == '\\'
     local mkdir_cmd = is_windows and "md " or "mkdir -p "
@@ -184,6 +233,7 @@ local function finalize()
   if not session then return end
   rime_api:cleanup_all_sessions()
   rime_api:finalize()
+  if config.prefetch == 'lock' then rime_api:prefetch_unlock() end
   session = nil
 end
 -------------------------------------------------------------------------------
@@ -603,6 +653,7 @@ local function test_func()
   if ok then print() else colormsg('\n', 'red') end
   assert_exit(ok, 'Some tests failed')
   finalize()
+  if config.memory_dirs then rime_api:release_memory_dirs() end
 end
 -------------------------------------------------------------------------------
 test_func()
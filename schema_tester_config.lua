@@ -26,6 +26,17 @@ return {
   -- shared_data_dir = 'shared',
   -- absolute path or relative path to pwd, if not set, use `log` in the same dir of schema_tester.lua
   -- log_dir = 'log',
+  -- absolute path or relative path to pwd, if set, compiled dictionaries are restored from and stored to this dir
+  -- artifact_cache = 'schema_tester_cache',
+  -- size bound of artifact_cache in MB, least recently used entries are dropped beyond it, default 1024
+  -- artifact_cache_size = 1024,
+  -- prefetch compiled dictionaries into the page cache after selecting the schema, 'lock' to keep them mlock'ed
+  -- prefetch = true,
+  -- warm up the schema before the tests: true for the 50 most common syllables, a count, or a list of inputs
+  -- warm_up = true,
+  -- keep user data, build output and logs in a fresh dir on tmpfs (/dev/shm) removed at exit instead of the dirs above;
+  -- true, or a prebuilt user data dir (absolute or relative to pwd) to seed it with
+  -- memory_dirs = true,
   deploy = {
     default = {
       tests = {
@@ -8,6 +8,14 @@ traits.distribution_name = "rimeapi"
 traits.distribution_code_name = "rimeapi"
 traits.distribution_version = "1.0.0"
 traits.log_dir = "log"
+-- RIMEAPI_MEMORY_DIRS=1 keeps the user data, build output and logs on tmpfs,
+-- any other value seeds the user data with a copy of that dir
+local memory_dirs = os.getenv('RIMEAPI_MEMORY_DIRS')
+if memory_dirs and memory_dirs ~= '' then
+  local root = rime_api:use_memory_dirs(traits, memory_dirs ~= '1' and memory_dirs or nil)
+  assert(root and traits.user_data_dir:sub(1, #root) == root)
+  print('rime_api:use_memory_dirs passed: "' .. root .. '"')
+end
 if not os.mkdir then
   -- check system is windows or unix-like
   local is_windows = package.config:sub(1, 1) == '\\'
@@ -28,7 +36,8 @@ end)
 print('rime_api:set_notification_handler passed')
 rime_api:initialize(traits)
 print('rime_api:initialize passed')
-if rime_api:start_maintenance(true) then
+local maintained = rime_api:start_maintenance(true)
+if maintained then
   rime_api:join_maintenance_thread()
   print('rime_api:join_maintenance_thread passed')
   print('rime_api:start_maintenance passed')
@@ -38,6 +47,23 @@ if rime_api:start_maintenance(true) then
 end
 
 rime_api:drain_notifications()
+local noti_stats = rime_api:get_notification_stats()
+assert(noti_stats.capacity >= 1024 and noti_stats.pending == 0)
+assert(noti_stats.dropped >= 0 and noti_stats.overflowed >= 0)
+print('rime_api:get_notification_stats passed')
+local noti_fd = rime_api:get_notification_fd()
+assert(noti_fd == nil or (type(noti_fd) == 'number' and noti_fd >= 0))
+print('rime_api:get_notification_fd passed')
+local timings = rime_api:get_deploy_timings()
+-- the maintenance above deployed, its run must have been timed
+assert(not maintained or #timings > 0)
+for _, run in ipairs(timings) do
+  assert(run.finish >= run.start and run.duration >= 0)
+  assert(run.result == 'success' or run.result == 'failure')
+  print(string.format('deploy %s in %.3fs', run.result, run.duration))
+end
+assert(rime_api:get_steady_time() > 0)
+print('rime_api:get_deploy_timings passed')
 ----------------------------------------------------------------
 local session = rime_api:create_session()
 assert(session ~= 0)
@@ -71,6 +97,16 @@ print('rime_api:select_schema passed')
 --rime_api:drain_notifications()
 assert(rime_api:get_current_schema(session) == "luna_pinyin")
 print('rime_api:get_current_schema passed: ')
+assert(not pcall(rime_api.async, rime_api, 'select_schema', session, "luna_pinyin"))
+rime_api:set_concurrency_mode(true) -- async calls need it
+local future = rime_api:async('select_schema', session, "luna_pinyin")
+assert(future:wait(30) == true and future:ready() == true)
+assert(future:result() == true)
+assert(rime_api:get_current_schema(session) == "luna_pinyin")
+assert(pcall(rime_api.async, rime_api, 'create_session') == false)
+rime_api:set_concurrency_mode(false)
+future = nil
+print('rime_api:async passed')
 ----------------------------------------------------------------
 -- test for process_key press a
 assert(rime_api:process_key(session, 0x61, 0) == true)
@@ -189,6 +225,20 @@ assert(rime_api:get_context(session, context) == true)
 assert(context.composition.preedit == "" and context.composition.length == 0)
 print('rime_api:clear_composition passed')
 
+-- same calls with the session locks held, then back to the default
+assert(rime_api:get_concurrency_mode() == false)
+assert(rime_api:set_concurrency_mode(true) == false)
+assert(rime_api:get_concurrency_mode() == true)
+assert(rime_api:process_key(session, 0x61, 0) == true)
+assert(rime_api:get_input(session) == 'a')
+assert(rime_api:get_current_schema(session) ~= nil)
+assert(rime_api:clear_composition(session) == nil)
+assert(rime_api:get_version() ~= nil)
+assert(not pcall(rime_api.process_key, rime_api, {}, 0x61, 0))
+assert(rime_api:get_current_schema(session) == 'luna_pinyin') -- no lock left behind
+assert(rime_api:set_concurrency_mode(false) == true)
+print('rime_api:set_concurrency_mode passed')
+
 assert(rime_api:simulate_key_sequence(session, "nihao") == true)
 local candListIter = RimeCandidateListIterator()
 assert(candListIter ~= nil)
@@ -224,6 +274,39 @@ rime_api:drain_notifications()
 print('rime_api:set_option passed')
 assert(rime_api:get_option(session, "ascii_mode") == true)
 print('rime_api:get_option passed')
+local batches, records = 0, nil
+rime_api:set_notification_handler(function(_, recs)
+  batches = batches + 1
+  records = recs
+end, { batch = true })
+rime_api:set_option(session, "ascii_mode", false)
+rime_api:set_option(session, "ascii_mode", true)
+rime_api:drain_notifications()
+assert(batches == 1 and #records >= 2)
+for _, r in ipairs(records) do
+  assert(r.session ~= nil and type(r.type) == 'string' and type(r.value) == 'string')
+  assert(type(r.timestamp) == 'number')
+end
+assert(records[#records].timestamp >= records[1].timestamp)
+rime_api:set_notification_handler(function(_, recs) records = recs end,
+  { batch = true, types = { 'option' }, sessions = { session }, coalesce = true })
+rime_api:set_option(session, "ascii_mode", false)
+rime_api:set_option(session, "ascii_mode", true)
+rime_api:set_option(session, "ascii_mode", false)
+rime_api:set_property(session, "api_test_property", "filtered")
+records = nil
+rime_api:drain_notifications()
+assert(records ~= nil and #records == 1)
+assert(records[1].type == 'option' and records[1].value == '!ascii_mode')
+local filter_stats = rime_api:get_notification_stats()
+assert(filter_stats.coalesced == 2 and filter_stats.filtered >= 1)
+rime_api:set_option(session, "ascii_mode", true)
+assert(rime_api:set_notification_handler(function(_, id, t, v)
+  print(string.format('lua > [%s] %s %s', tostring(id), tostring(t), tostring(v)))
+end, 2048) == true)
+assert(rime_api:get_notification_stats().capacity == 2048)
+assert(not pcall(rime_api.set_notification_handler, rime_api, print, 2 ^ 40)) -- over the cap
+print('rime_api:set_notification_handler batch passed')
 assert(rime_api:set_property(session, "api_test_property", "test_value") == nil)
 rime_api:drain_notifications()
 assert(rime_api:get_property(session, "api_test_property", 256) == "test_value")
@@ -241,6 +324,11 @@ print('RimeSchemaList fields passed: size=' .. schemas.size)
 -- schema_info is nil when rime_api:get_schema_list(schemas)
 assert(schemas.list[1].schema_id == "luna_pinyin" and schemas.list[1].name == "朙月拼音" and schemas.list[1].schema_info == nil)
 print('RimeSchemaListItem fields passed: schema_id=' .. schemas.list[1].schema_id .. ', name=' .. schemas.list[1].name .. ', schema_info=' .. tostring(schemas.list[1].schema_info))
+local cached_list = schemas.list
+assert(rime_api:get_schema_list(schemas) == true)
+assert(#schemas.list == #cached_list and schemas.list ~= cached_list)
+assert(schemas.list[2].schema_id == cached_list[2].schema_id)
+print('rime_api:get_schema_list cache passed')
 assert(rime_api:free_schema_list(schemas) == nil)
 print('rime_api:free_schema_list passed')
 schemas = nil
@@ -257,6 +345,84 @@ rime_api:drain_notifications()
 print('rime_api:deploy_schema passed')
 assert(rime_api:deploy_config_file("api_test", "0.1") == true) -- with config id only
 print('rime_api:deploy_config_file passed')
+local incremental = rime_api:deploy_incremental({ './shared/luna_pinyin.schema.yaml', { file = 'api_test', version_key = '0.1' } }, { force = true })
+assert(#incremental.deployed == 2 and #incremental.skipped == 0 and #incremental.failed == 0)
+incremental = rime_api:deploy_incremental({ './shared/luna_pinyin.schema.yaml', { file = 'api_test', version_key = '0.1' } })
+assert(#incremental.skipped == 2 and #incremental.deployed == 0)
+incremental = rime_api:deploy_incremental({ './shared/luna_pinyin.schema.yaml' }, { force = true, cache = traits.user_data_dir .. '/artifact_cache' })
+assert(#incremental.deployed + #incremental.restored == 1)
+incremental = rime_api:deploy_incremental({ './shared/luna_pinyin.schema.yaml' }, { force = true, cache = traits.user_data_dir .. '/artifact_cache' })
+assert(#incremental.restored == 1) -- the dictionaries stored by the call above
+rime_api:drain_notifications()
+print('rime_api:deploy_incremental passed')
+local inputs, has_dict = rime_api:deploy_inputs('./shared/luna_pinyin.schema.yaml'), false
+for _, path in ipairs(inputs) do has_dict = has_dict or path:match('luna_pinyin%.dict%.yaml$') ~= nil end
+assert(has_dict)
+print('rime_api:deploy_inputs passed')
+local watcher = rime_api:watch({ traits.user_data_dir })
+if watcher then -- inotify on Linux only
+  local f = io.open(traits.user_data_dir .. '/watch_test.yaml', 'w')
+  f:write('watch: 1\n')
+  f:close()
+  local changed, seen = watcher:wait(10, 2), false
+  for _, path in ipairs(changed or {}) do seen = seen or path:match('watch_test%.yaml$') ~= nil end
+  assert(seen)
+  os.remove(traits.user_data_dir .. '/watch_test.yaml')
+  watcher:close()
+end
+print('rime_api:watch passed')
+local prefetched = rime_api:prefetch('luna_pinyin'):wait()
+local prefetch_stats = rime_api:get_prefetch_stats()
+assert(prefetched > 0 and prefetch_stats.bytes == prefetched and prefetch_stats.files > 0)
+assert(prefetch_stats.locked == 0 and prefetch_stats.seconds >= 0)
+assert(rime_api:prefetch('luna_pinyin', true):wait() == prefetched)
+local locked = rime_api:get_prefetch_stats().locked -- 0 when over RLIMIT_MEMLOCK
+assert(rime_api:prefetch_unlock() == locked and rime_api:get_prefetch_stats().locked == 0)
+print('rime_api:prefetch passed')
+local residency = rime_api:get_page_cache_residency('luna_pinyin')
+assert(residency.files == prefetch_stats.files and residency.bytes == prefetched)
+assert(residency.resident >= 0 and residency.resident <= residency.bytes)
+print('rime_api:get_page_cache_residency passed')
+local evicted = rime_api:evict_page_cache('luna_pinyin')
+assert(evicted.files == residency.files and evicted.bytes == residency.bytes)
+assert(evicted.resident >= 0 and evicted.resident <= evicted.bytes)
+print('rime_api:evict_page_cache passed')
+local usage = rime_api:get_resource_usage()
+assert(usage.rss >= 0 and usage.max_rss >= 0 and usage.minor_faults >= 0 and usage.major_faults >= 0)
+print('rime_api:get_resource_usage passed')
+local samples = rime_api:warm_up('luna_pinyin', 5)
+assert(#samples == 5 and samples[1].seconds >= 0 and samples[1].candidates > 0)
+-- digits and ';' are not typed, they would select a candidate
+samples = rime_api:warm_up('luna_pinyin', { 'a', 'ni1;' })
+assert(#samples == 2 and samples[2].input == 'ni1;' and samples[2].candidates > 0)
+assert(samples[1].committed == false and samples[2].committed == false)
+print('rime_api:warm_up passed')
+assert(not pcall(rime_api.deploy_schema_async, rime_api, "./shared/luna_pinyin.schema.yaml"))
+assert(rime_api:set_concurrency_mode(true) == false) -- deploy tasks need it
+rime_api:set_option(session, "ascii_mode", false)
+local task = rime_api:deploy_schema_async("./shared/luna_pinyin.schema.yaml")
+-- the deploy only holds the global lock shared, the session is served meanwhile
+assert(rime_api:process_key(session, 0x61, 0) == true)
+assert(rime_api:get_input(session) == 'a')
+assert(rime_api:clear_composition(session) == nil)
+local waiter = coroutine.wrap(function() return task:wait() end)
+local task_ok, task_result = waiter()
+while task_ok == task do
+  -- yielded while running; a scheduler would poll task:fd(), block on the
+  -- completion instead of spinning
+  task:wait(1)
+  task_ok, task_result = waiter()
+end
+assert(task_ok == true and task_result == 'success' and task:done())
+assert(select(2, task:result()) == 'success')
+task = rime_api:start_maintenance_async(false)
+task_ok, task_result = task:wait()
+assert(task_ok == true and (task_result == 'success' or task_result == 'skipped'))
+assert(rime_api:is_maintenance_mode() == false or rime_api:is_maintenance_mode() == 0)
+task = nil
+assert(rime_api:set_concurrency_mode(false) == true)
+rime_api:drain_notifications()
+print('rime_api:deploy_schema_async and rime_api:start_maintenance_async passed')
 
 local config = RimeConfig()
 assert(config ~= nil)
@@ -402,6 +568,17 @@ print('rime_api:config_init passed')
 assert(rime_api:config_load_string(config, 'a_string: a_string_loaded_from_string\na_item:\n  - list_item1\n  - list_item2\n  - list_item3\nmap_item1: map_item1_value\nmap_item2: 233') == true)
 assert(config:get_string("a_string") == "a_string_loaded_from_string")
 print('rime_api:config_load_string passed')
+local yaml_path = traits.user_data_dir .. '/load_file_test.yaml'
+local yaml_file = io.open(yaml_path, 'w')
+yaml_file:write('loaded_from: file\nloaded_int: 42\n')
+yaml_file:close()
+local file_config = RimeConfig()
+assert(file_config:load_file(yaml_path) == true)
+assert(file_config:get_string("loaded_from") == "file")
+assert(file_config:get_int("loaded_int") == 42)
+assert(RimeConfig():load_file(yaml_path .. '.missing') == false)
+os.remove(yaml_path)
+print('config:load_file passed')
 local item = RimeConfig()
 assert(rime_api:config_get_item(config, "a_item", item) == true)
 print('rime_api:config_get_item passed')
@@ -464,6 +641,24 @@ print('rime_api:sync_user_data passed')
 rime_api:finalize()
 rime_api:drain_notifications()
 print('rime_api:finalize passed')
+local scratch = RimeTraits()
+local scratch_root = assert(rime_api:use_memory_dirs(scratch))
+assert(os.isdir(scratch.user_data_dir) and os.isdir(scratch.staging_dir) and os.isdir(scratch.log_dir))
+assert(rime_api:release_memory_dirs() >= 1 and not os.isdir(scratch_root))
+print('rime_api:release_memory_dirs passed')
+-- copies only, the hardlinked artifacts would turn read-only in api_test/build
+local clone_dir = assert(rime_api:use_memory_dirs(RimeTraits())) .. '/clone'
+local cloned = assert(rime_api:clone_user_data_dir(traits.user_data_dir, clone_dir, false))
+assert(cloned.files > 0 and cloned.linked == 0 and cloned.cloned + cloned.copied == cloned.files)
+assert(os.isdir(clone_dir .. '/build') and cloned.seconds >= 0)
+assert(rime_api:clone_user_data_dir(traits.user_data_dir, clone_dir) == nil) -- not empty
+-- hardlinks from the scratch copy, which may turn read-only
+local linked = assert(rime_api:clone_user_data_dir(clone_dir, clone_dir .. '2'))
+assert(linked.files == cloned.files and linked.linked + linked.cloned + linked.copied == linked.files)
+assert(linked.linked > 0 or linked.cloned > 0) -- build/*.bin shared either way
+assert(os.isdir(clone_dir .. '2/build'))
+rime_api:release_memory_dirs()
+print('rime_api:clone_user_data_dir passed')
 rime_api = nil
 traits = nil
 collectgarbage("collect")
@@ -105,6 +105,11 @@ if levers:load_settings(switcher_settings) then
   assert(levers:schema_list_destroy(schemaselected) == nil)
   assert(levers:schema_list_destroy(schemalist) == nil)
   print('levers:schema_list_destroy passed')
+  local catalog = levers:get_schema_catalog()
+  assert(type(catalog) == 'table' and #catalog > 0)
+  assert(catalog[1].schema_id ~= nil)
+  assert(#levers:get_schema_catalog() == #catalog)
+  print('levers:get_schema_catalog passed')
 end
 local api_settings = levers:custom_settings_init('api_test', "rimeapi.lua")
 assert(api_settings ~= nil)
@@ -142,6 +147,16 @@ a_list:
   assert(levers:save_settings(api_settings) ~= nil)
   print('levers:customize_item passed')
   a_patch = nil
+  assert(levers:customize_batch(api_settings, {
+    batch = { int = 7, string = "batched", nested = { bool = true } },
+    batch_list = { "x", "y" },
+  }) == true)
+  assert(levers:settings_is_modified(api_settings) == false)
+  local ok, err = levers:customize_batch(api_settings, { batch_bad = { 1, print } })
+  assert(ok == false and err ~= nil)
+  assert(levers:customize_batch(api_settings, {}) == true)
+  assert(levers:customize_batch(api_settings, { batch_empty = {} }) == true)
+  print('levers:customize_batch passed')
 end
 
 rime_api:finalize()
@@ -174,6 +189,11 @@ assert(rime_api:config_get_bool(api_test, "a_bool") == false)
 print('api_test customization bool verified')
 assert(rime_api:config_get_double(api_test, "a_double") == 3.14)
 print('api_test customization double verified')
+assert(rime_api:config_get_int(api_test, "batch/int") == 7)
+assert(rime_api:config_get_string(api_test, "batch/string") == "batched")
+assert(rime_api:config_get_bool(api_test, "batch/nested/bool") == true)
+assert(rime_api:config_get_string(api_test, "batch_list/@1") == "y")
+print('api_test customization batch verified')
 -------------------------------------------------------------------------------
 local uditer = RimeUserDictIterator()
 assert(uditer ~= nil)
@@ -196,6 +216,12 @@ assert(levers:import_user_dict('luna_pinyin', 'luna_pinyin.export.txt') ~= nil)
 print('levers:import_user_dict passed')
 assert(levers:backup_user_dict('luna_pinyin') == true)
 print('levers:backup_user_dict passed')
+rime_api:set_concurrency_mode(true) -- async calls need it
+local exported = rime_api:async('export_user_dict', 'luna_pinyin', 'luna_pinyin.export.txt')
+assert(type(exported:wait()) == 'number')
+assert(rime_api:async('backup_user_dict', 'luna_pinyin'):wait() == true)
+rime_api:set_concurrency_mode(false)
+print('rime_api:async user dict calls passed')
 local snap = (rime_api:get_user_data_sync_dir(512) .. '/luna_pinyin.userdb.txt')
 assert(levers:restore_user_dict(snap) == true)
 print('levers:restore_user_dict passed')
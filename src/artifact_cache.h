@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Local store of compiled dictionaries (.table.bin, .prism.bin,
+// .reverse.bin), one directory per key named by its hex digest. The key is
+// the hash of every input of a schema and the librime version, so an entry
+// never goes stale; it is dropped only to keep the store under max_bytes,
+// least recently restored first (the entry dir mtime is its last use).
+//
+// Several processes may share a store: entries are filled aside and renamed
+// into place, a reader losing a race to eviction sees a miss. Restored files
+// are still checked by librime, which compares the source checksums kept in
+// each .bin and recompiles on a mismatch.
+class ArtifactCache {
+ public:
+  static constexpr uintmax_t kDefaultMaxBytes = uintmax_t(1) << 30;
+  // a .tmp entry untouched for longer was left by a Store that died
+  static constexpr std::chrono::hours kStaleTmpAge{1};
+
+  ArtifactCache(std::filesystem::path dir, uintmax_t max_bytes)
+      : dir_(std::move(dir)), max_bytes_(max_bytes ? max_bytes : kDefaultMaxBytes) {}
+
+  const std::filesystem::path& dir() const { return dir_; }
+
+  // the .bin files compiled from the dictionaries, by dictionary name
+  static std::vector<std::string> ArtifactNames(const std::vector<std::string>& dicts) {
+    std::vector<std::string> names;
+    for (const auto& dict : dicts)
+      for (const char* ext : {".table.bin", ".prism.bin", ".reverse.bin"})
+        names.push_back(dict + ext);
+    return names;
+  }
+
+  // copies the files of key into dest, their names into names if given;
+  // false on a miss
+  bool Restore(uint64_t key, const std::filesystem::path& dest,
+               std::vector<std::string>* names = nullptr) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path entry = dir_ / Hex(key);
+    size_t restored = 0;
+    for (fs::directory_iterator it(entry, ec), end; !ec && it != end; it.increment(ec)) {
+      std::error_code type_ec;
+      if (!it->is_regular_file(type_ec)) continue;
+      // copied aside and renamed over, nothing sees a partial .bin
+      const fs::path target = dest / it->path().filename();
+      fs::path tmp = target;
+      tmp += ".restore";
+      std::error_code copy_ec;
+      if (!restored) fs::create_directories(dest, copy_ec);
+      if (!fs::copy_file(it->path(), tmp, fs::copy_options::overwrite_existing, copy_ec)) {
+        fs::remove(tmp, copy_ec);
+        return false;
+      }
+      fs::rename(tmp, target, copy_ec);
+      if (copy_ec) {
+        fs::remove(tmp, copy_ec);
+        return false;
+      }
+      ++restored;
+      if (names) names->push_back(it->path().filename().string());
+    }
+    if (!restored) return false;
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+    return true;
+  }
+
+  // copies those of names present in src under key, then evicts
+  bool Store(uint64_t key, const std::filesystem::path& src,
+             const std::vector<std::string>& names) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path entry = dir_ / Hex(key);
+    if (fs::exists(entry, ec)) return true;
+    fs::path tmp = entry;
+    tmp += ".tmp" + Hex(std::random_device{}());
+    fs::create_directories(tmp, ec);
+    if (ec) return false;
+    size_t stored = 0;
+    bool failed = false;
+    for (const auto& name : names) {
+      std::error_code file_ec;
+      if (!fs::is_regular_file(src / name, file_ec)) continue;
+      if (!fs::copy_file(src / name, tmp / name, file_ec)) {
+        failed = true;
+        break;
+      }
+      ++stored;
+    }
+    // another process storing the same key wins the rename, both are equal
+    if (!failed && stored) fs::rename(tmp, entry, ec);
+    if (failed || !stored || ec) {
+      fs::remove_all(tmp, ec);
+      return false;
+    }
+    Evict();
+    return true;
+  }
+
+  // removes the entry of key, for one librime refused and compiled again
+  bool Drop(uint64_t key) {
+    std::error_code ec;
+    return std::filesystem::remove_all(dir_ / Hex(key), ec) > 0 && !ec;
+  }
+
+  // drops the least recently used entries until the store fits max_bytes,
+  // and the stale .tmp entries; returns the bytes left
+  uintmax_t Evict() {
+    namespace fs = std::filesystem;
+    struct Entry {
+      fs::path path;
+      fs::file_time_type used;
+      uintmax_t bytes;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+      const fs::path path = it->path();
+      std::error_code entry_ec;
+      if (!it->is_directory(entry_ec)) continue;
+      // a half written entry belongs to a running Store, unless it is stale
+      if (path.extension().string().rfind(".tmp", 0) == 0) {
+        const fs::file_time_type written = fs::last_write_time(path, entry_ec);
+        if (!entry_ec && fs::file_time_type::clock::now() - written > kStaleTmpAge)
+          fs::remove_all(path, entry_ec);
+        continue;
+      }
+      Entry e{path, fs::last_write_time(path, entry_ec), 0};
+      for (fs::directory_iterator f(path, entry_ec), f_end; !entry_ec && f != f_end;
+           f.increment(entry_ec)) {
+        std::error_code size_ec;
+        const uintmax_t size = f->file_size(size_ec);
+        if (!size_ec) e.bytes += size;
+      }
+      total += e.bytes;
+      entries.push_back(std::move(e));
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const auto& e : entries) {
+      if (total <= max_bytes_) break;
+      std::error_code remove_ec;
+      fs::remove_all(e.path, remove_ec);
+      if (!remove_ec) total -= e.bytes;
+    }
+    return total;
+  }
+
+  static std::string Hex(uint64_t key) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+    return hex;
+  }
+
+ private:
+  std::filesystem::path dir_;
+  uintmax_t max_bytes_;
+};
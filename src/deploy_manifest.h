@@ -0,0 +1,497 @@
+#pragma once
+
+#include "artifact_cache.h"
+#include "mapped_file.h"
+#include "session_locks.h"
+#include <rime_api.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// XXH64 of a buffer
+inline uint64_t hash64(const void* input, size_t len, uint64_t seed = 0) {
+  constexpr uint64_t P1 = 0x9E3779B185EBCA87ull, P2 = 0xC2B2AE3D27D4EB4Full,
+                     P3 = 0x165667B19E3779F9ull, P4 = 0x85EBCA77C2B2AE63ull,
+                     P5 = 0x27D4EB2F165667C5ull;
+  const auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  const auto read64 = [](const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; };
+  const auto read32 = [](const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; };
+  const auto mix = [&](uint64_t acc, uint64_t lane) {
+    return rotl(acc + lane * P2, 31) * P1;
+  };
+  const auto merge = [&](uint64_t acc, uint64_t v) {
+    return (acc ^ mix(0, v)) * P1 + P4;
+  };
+  const unsigned char* p = static_cast<const unsigned char*>(input);
+  const unsigned char* const end = p + len;
+  uint64_t h;
+  if (len >= 32) {
+    uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = mix(v1, read64(p));
+      v2 = mix(v2, read64(p + 8));
+      v3 = mix(v3, read64(p + 16));
+      v4 = mix(v4, read64(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+  } else {
+    h = seed + P5;
+  }
+  h += (uint64_t)len;
+  for (; p + 8 <= end; p += 8)
+    h = rotl(h ^ mix(0, read64(p)), 27) * P1 + P4;
+  if (p + 4 <= end) {
+    h = rotl(h ^ ((uint64_t)read32(p) * P1), 23) * P2 + P3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+    h = rotl(h ^ (*p * P5), 11) * P1;
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+// content hash of each file on up to threads threads, 0 for a missing file
+inline std::vector<uint64_t> hash_files(const std::vector<std::filesystem::path>& files,
+                                        size_t threads) {
+  std::vector<uint64_t> hashes(files.size(), 0);
+  std::atomic<size_t> next{0};
+  const auto work = [&]() {
+    for (size_t i; (i = next.fetch_add(1)) < files.size();) {
+      MappedFile file(files[i]);
+      // an empty file still differs from a missing one
+      if (file.ok()) hashes[i] = hash64(file.c_str(), file.size()) | 1;
+    }
+  };
+  threads = std::max<size_t>(1, std::min(threads, files.size()));
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; ++i) pool.emplace_back(work);
+  work();
+  for (auto& t : pool) t.join();
+  return hashes;
+}
+
+// Content hashes of what went into each deploy_schema / deploy_config_file
+// call, kept in a text file next to the build dir. A call whose inputs hash
+// the same as at its last successful run, and whose output and compiled
+// dictionaries (the .bin files it left) are still in the staging dir, is
+// skipped; mtimes play no part.
+//
+// Inputs of a schema: the schema yaml and its .custom.yaml, every yaml
+// pulled in by __include / __patch, the dictionaries named by any
+// `dictionary:` key with their import_tables, and the vocabulary they use.
+// Of a config file: the file, its .custom.yaml and its includes.
+//
+// With an ArtifactCache, a schema to deploy first gets its compiled
+// dictionaries restored from the cache, keyed by the input hashes under
+// their file names so that the key holds across checkouts; deploy_schema
+// then finds them up to date. Freshly compiled ones are stored back, as
+// are those librime compiled again over a restored one it refused (the
+// schema then counts as deployed, not restored).
+class DeployManifest {
+ public:
+  struct Item {
+    std::string file;         // schema file path, or config file name
+    std::string version_key;  // config files only
+    bool is_schema = false;
+  };
+  enum Result { kSkipped = 0, kDeployed, kFailed, kRestored };
+
+  DeployManifest(std::filesystem::path user_dir, std::filesystem::path shared_dir,
+                 std::filesystem::path staging_dir, std::filesystem::path manifest,
+                 std::string salt)
+      : user_dir_(std::move(user_dir)), shared_dir_(std::move(shared_dir)),
+        staging_dir_(std::move(staging_dir)), manifest_(std::move(manifest)),
+        salt_(std::move(salt)) {
+    if (manifest_.empty()) manifest_ = DefaultPath(staging_dir_);
+  }
+
+  // <staging_dir>.manifest, beside build/
+  static std::filesystem::path DefaultPath(std::filesystem::path staging_dir) {
+    if (!staging_dir.has_filename()) staging_dir = staging_dir.parent_path();
+    return staging_dir.concat(".manifest");
+  }
+  const std::filesystem::path& path() const { return manifest_; }
+
+  // deploy runs on the calling thread, one item at a time; cache may be null
+  std::vector<Result> Deploy(const std::vector<Item>& items,
+                             const std::function<bool(const Item&)>& deploy,
+                             size_t threads, bool force, ArtifactCache* cache = nullptr) {
+    Load();
+    std::vector<std::vector<std::filesystem::path>> inputs(items.size());
+    std::vector<std::filesystem::path> files;
+    std::map<std::filesystem::path, size_t> index;
+    for (size_t i = 0; i < items.size(); ++i) {
+      inputs[i] = Inputs(items[i]);
+      for (const auto& f : inputs[i])
+        if (index.emplace(f, files.size()).second) files.push_back(f);
+    }
+    const std::vector<uint64_t> hashes = hash_files(files, threads);
+    std::vector<Result> results(items.size(), kSkipped);
+    for (size_t i = 0; i < items.size(); ++i) {
+      std::string key = Key(items[i]);
+      std::string digest = salt_;
+      for (const auto& f : inputs[i]) {
+        const uint64_t h = hashes[index[f]];
+        digest += f.generic_string();
+        digest.append(reinterpret_cast<const char*>(&h), sizeof(h));
+      }
+      const uint64_t combined = hash64(digest.data(), digest.size());
+      const auto it = entries_.find(key);
+      if (!force && it != entries_.end() && it->second == combined && UpToDate(items[i], key))
+        continue;
+      const bool cached = cache && items[i].is_schema;
+      const uint64_t cache_key = cached ? CacheKey(items[i], inputs[i], hashes, index) : 0;
+      std::vector<std::string> restored_names;
+      bool restored = cached && cache->Restore(cache_key, staging_dir_, &restored_names);
+      const std::vector<Stamp> before = restored ? Stamps(restored_names) : std::vector<Stamp>();
+      const std::vector<std::string> names = items[i].is_schema
+          ? ArtifactCache::ArtifactNames(Dictionaries(inputs[i])) : std::vector<std::string>();
+      if (deploy(items[i])) {
+        // librime compiles a restored .bin again when its checksums do not
+        // match; that build is the one to keep
+        const bool recompiled = restored && Stamps(restored_names) != before;
+        if (recompiled) {
+          restored = false;
+          cache->Drop(cache_key);
+        }
+        entries_[key] = combined;
+        artifacts_[key] = Present(names);
+        results[i] = restored ? kRestored : kDeployed;
+        if (cached && !restored)
+          cache->Store(cache_key, staging_dir_, names);
+      } else {
+        entries_.erase(key);
+        artifacts_.erase(key);
+        results[i] = kFailed;
+      }
+    }
+    Save();
+    return results;
+  }
+
+  // resolved inputs, sorted; missing ones keep their user dir path so that
+  // adding the file later changes the hash
+  std::vector<std::filesystem::path> Inputs(const Item& item) const {
+    std::set<std::filesystem::path> found;
+    std::string id;
+    if (item.is_schema) {
+      const std::filesystem::path file(item.file);
+      id = SchemaId(file);
+      found.insert(file);
+      ScanYaml(file, &found);
+      AddYaml(id + ".schema.custom.yaml", &found);
+    } else {
+      const std::string name = YamlName(std::filesystem::path(item.file).filename().string());
+      id = name.substr(0, name.size() - 5);
+      AddYaml(name, &found);
+      AddYaml(id + ".custom.yaml", &found);
+    }
+    return std::vector<std::filesystem::path>(found.begin(), found.end());
+  }
+
+  // names of the *.dict.yaml among the inputs
+  static std::vector<std::string> Dictionaries(const std::vector<std::filesystem::path>& inputs) {
+    const std::string suffix = ".dict.yaml";
+    std::vector<std::string> dicts;
+    for (const auto& f : inputs) {
+      const std::string name = f.filename().string();
+      if (name.size() > suffix.size() &&
+          name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+        dicts.push_back(name.substr(0, name.size() - suffix.size()));
+    }
+    return dicts;
+  }
+
+ private:
+  static std::string SchemaId(const std::filesystem::path& file) {
+    std::string name = file.filename().string();
+    const std::string suffix = ".schema.yaml";
+    if (name.size() > suffix.size() &&
+        name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+      name.resize(name.size() - suffix.size());
+    return name;
+  }
+  // names and hashes only, the dirs differ between machines
+  uint64_t CacheKey(const Item& item, const std::vector<std::filesystem::path>& inputs,
+                    const std::vector<uint64_t>& hashes,
+                    const std::map<std::filesystem::path, size_t>& index) const {
+    std::string digest = salt_ + '\t' + SchemaId(item.file);
+    for (const auto& f : inputs) {
+      const uint64_t h = hashes[index.at(f)];
+      digest += '\t' + f.filename().string();
+      digest.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    }
+    return hash64(digest.data(), digest.size());
+  }
+  std::string Key(const Item& item) const {
+    return item.is_schema ? "schema\t" + item.file
+                          : "config\t" + item.file + "\t" + item.version_key;
+  }
+  // the output and every compiled dictionary there was after the last deploy
+  bool UpToDate(const Item& item, const std::string& key) const {
+    std::error_code ec;
+    if (!std::filesystem::exists(Output(item), ec)) return false;
+    const auto it = artifacts_.find(key);
+    if (it == artifacts_.end()) return true;
+    for (const auto& name : it->second)
+      if (!std::filesystem::exists(staging_dir_ / name, ec)) return false;
+    return true;
+  }
+  // of names, those in the staging dir
+  std::vector<std::string> Present(const std::vector<std::string>& names) const {
+    std::vector<std::string> present;
+    std::error_code ec;
+    for (const auto& name : names)
+      if (std::filesystem::is_regular_file(staging_dir_ / name, ec)) present.push_back(name);
+    return present;
+  }
+  // mtime and size of files in the staging dir, -1 for a missing one
+  using Stamp = std::pair<int64_t, uintmax_t>;
+  std::vector<Stamp> Stamps(const std::vector<std::string>& names) const {
+    std::vector<Stamp> stamps;
+    for (const auto& name : names) {
+      std::error_code ec;
+      const auto mtime = std::filesystem::last_write_time(staging_dir_ / name, ec);
+      const uintmax_t size = ec ? 0 : std::filesystem::file_size(staging_dir_ / name, ec);
+      stamps.emplace_back(ec ? -1 : (int64_t)mtime.time_since_epoch().count(), size);
+    }
+    return stamps;
+  }
+  std::filesystem::path Output(const Item& item) const {
+    if (item.is_schema)
+      return staging_dir_ / (SchemaId(item.file) + ".schema.yaml");
+    return staging_dir_ / YamlName(std::filesystem::path(item.file).filename().string());
+  }
+  std::filesystem::path Resolve(const std::string& name) const {
+    const std::filesystem::path user = user_dir_ / name;
+    if (std::filesystem::exists(user)) return user;
+    const std::filesystem::path shared = shared_dir_ / name;
+    if (std::filesystem::exists(shared)) return shared;
+    return user;
+  }
+  void AddYaml(const std::string& name, std::set<std::filesystem::path>* found) const {
+    const std::filesystem::path path = Resolve(name);
+    if (found->insert(path).second) ScanYaml(path, found);
+  }
+  void AddDict(const std::string& name, std::set<std::filesystem::path>* found) const {
+    const std::filesystem::path path = Resolve(name + ".dict.yaml");
+    if (!found->insert(path).second) return;
+    MappedFile file(path);
+    if (!file.ok()) return;
+    // the header ends at the first "..." line, the entries are not read
+    bool vocabulary = false;
+    std::string list;
+    ForEachLine(file.c_str(), [&](const std::string& line, bool& stop) {
+      if (line == "...") { stop = true; return; }
+      std::string key, value;
+      if (line.empty() || !SplitKey(line, &key, &value)) {
+        if (list == "import_tables" && !value.empty()) AddDict(value, found);
+        return;
+      }
+      list.clear();
+      if (key == "import_tables") {
+        if (value.empty()) list = key;
+        else ForEachFlowItem(value, [&](const std::string& v) { AddDict(v, found); });
+      } else if (key == "vocabulary" && !value.empty()) {
+        found->insert(Resolve(value + ".txt"));
+        vocabulary = true;
+      } else if (key == "use_preset_vocabulary" && value == "true" && !vocabulary) {
+        found->insert(Resolve("essay.txt"));
+      }
+    });
+  }
+  // __include / __patch targets and dictionaries
+  void ScanYaml(const std::filesystem::path& path, std::set<std::filesystem::path>* found) const {
+    MappedFile file(path);
+    if (!file.ok()) return;
+    std::string list;
+    ForEachLine(file.c_str(), [&](const std::string& line, bool&) {
+      std::string key, value;
+      if (line.empty()) return;
+      if (!SplitKey(line, &key, &value)) {
+        if (!list.empty()) AddReference(value, found);
+        return;
+      }
+      list.clear();
+      if (key == "__include" || key == "__patch") {
+        if (value.empty()) list = key;
+        else ForEachFlowItem(value, [&](const std::string& v) { AddReference(v, found); });
+      } else if (key == "dictionary" && !value.empty()) {
+        AddDict(value, found);
+      }
+    });
+  }
+  // "file:/path" or "file.yaml:/path"; "/path" stays in the same file
+  void AddReference(const std::string& ref, std::set<std::filesystem::path>* found) const {
+    const size_t colon = ref.find(":/");
+    if (colon == std::string::npos || colon == 0) return;
+    AddYaml(YamlName(ref.substr(0, colon)), found);
+  }
+  // config ids name files too, "default" is default.yaml
+  static std::string YamlName(std::string name) {
+    if (name.size() < 5 || name.compare(name.size() - 5, 5, ".yaml") != 0) name += ".yaml";
+    return name;
+  }
+
+  // where " #" starts a comment, not inside a quoted scalar; a quote only
+  // opens one where a scalar may start (line start, after a space, '[' or ',')
+  static size_t CommentStart(const std::string& s) {
+    char quote = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+      const char c = s[i];
+      if (quote) {
+        if (c == '\\' && quote == '"') ++i;  // escaped char
+        else if (c == '\'' && quote == '\'' && i + 1 < s.size() && s[i + 1] == '\'') ++i;  // ''
+        else if (c == quote) quote = 0;
+      } else if (c == '"' || c == '\'') {
+        if (i == 0 || strchr(" \t[,", s[i - 1])) quote = c;
+      } else if (c == '#' && i > 0 && s[i - 1] == ' ') {
+        return i - 1;
+      }
+    }
+    return std::string::npos;
+  }
+  static std::string Trim(std::string s) {
+    const size_t hash = CommentStart(s);
+    if (hash != std::string::npos) s.resize(hash);
+    const auto space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    while (!s.empty() && space(s.back())) s.pop_back();
+    size_t start = 0;
+    while (start < s.size() && space(s[start])) ++start;
+    s.erase(0, start);
+    if (s.size() >= 2 && (s[0] == '"' || s[0] == '\'') && s.back() == s[0])
+      s = s.substr(1, s.size() - 2);
+    return s;
+  }
+  // "key: value" -> true; "- item" -> false with value = item
+  static bool SplitKey(const std::string& line, std::string* key, std::string* value) {
+    std::string s = Trim(line);
+    if (s.empty() || s[0] == '#') return false;
+    if (s[0] == '-') {
+      *value = Trim(s.substr(1));
+      return false;
+    }
+    const size_t colon = s.find(": ");
+    if (colon == std::string::npos && (s.empty() || s.back() != ':')) return false;
+    *key = Trim(s.substr(0, colon == std::string::npos ? s.size() - 1 : colon));
+    *value = colon == std::string::npos ? "" : Trim(s.substr(colon + 2));
+    return true;
+  }
+  // "[a, b]" or a scalar
+  template<typename F>
+  static void ForEachFlowItem(const std::string& value, F f) {
+    if (value.empty() || value[0] != '[') {
+      f(value);
+      return;
+    }
+    std::stringstream items(value.substr(1, value.find(']') - 1));
+    for (std::string item; std::getline(items, item, ',');)
+      if (!(item = Trim(item)).empty()) f(item);
+  }
+  template<typename F>
+  static void ForEachLine(const char* text, F f) {
+    bool stop = false;
+    for (const char* p = text; *p && !stop;) {
+      const char* eol = strchr(p, '\n');
+      size_t n = eol ? (size_t)(eol - p) : strlen(p);
+      if (n > 0 && p[n - 1] == '\r') --n;
+      f(std::string(p, n), stop);
+      if (!eol) break;
+      p = eol + 1;
+    }
+  }
+
+  // "<hash>\t<key>" per item, then "=<artifact>\t<key>" per compiled
+  // dictionary it had
+  void Load() {
+    entries_.clear();
+    artifacts_.clear();
+    std::ifstream in(manifest_);
+    std::string line;
+    while (std::getline(in, line)) {
+      const size_t tab = line.find('\t');
+      if (tab == std::string::npos) continue;
+      if (line[0] == '=')
+        artifacts_[line.substr(tab + 1)].push_back(line.substr(1, tab - 1));
+      else
+        entries_[line.substr(tab + 1)] = strtoull(line.c_str(), nullptr, 16);
+    }
+  }
+  // written aside and renamed over, a crash leaves the old manifest
+  bool Save() const {
+    std::filesystem::path tmp = manifest_;
+    tmp += ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::trunc);
+      if (!out) return false;
+      char hex[17];
+      for (const auto& [key, hash] : entries_) {
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+        out << hex << '\t' << key << '\n';
+        const auto it = artifacts_.find(key);
+        if (it == artifacts_.end()) continue;
+        for (const auto& name : it->second) out << '=' << name << '\t' << key << '\n';
+      }
+      if (!out.flush()) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, manifest_, ec);
+    return !ec;
+  }
+
+  std::filesystem::path user_dir_, shared_dir_, staging_dir_, manifest_;
+  std::string salt_;
+  std::map<std::string, uint64_t> entries_;
+  std::map<std::string, std::vector<std::string>> artifacts_;
+};
+
+// the manifest for the dirs librime was set up with
+inline DeployManifest deploy_manifest_of(RimeApi* api, const std::string& manifest) {
+  char user_dir[1024] = {0}, shared_dir[1024] = {0}, staging_dir[1024] = {0};
+  api->get_user_data_dir_s(user_dir, sizeof(user_dir));
+  api->get_shared_data_dir_s(shared_dir, sizeof(shared_dir));
+  api->get_staging_dir_s(staging_dir, sizeof(staging_dir));
+  const char* version = api->get_version();
+  return DeployManifest(user_dir, shared_dir, staging_dir, manifest, version ? version : "");
+}
+
+// deploy_schema / deploy_config_file through the manifest; items naming a
+// *.schema.yaml are schemas. manifest may be empty for the default path,
+// cache_dir empty for no artifact cache, cache_size 0 for its default bound
+inline std::vector<DeployManifest::Result> deploy_incremental(
+    RimeApi* api, const std::vector<DeployManifest::Item>& items,
+    const std::string& manifest, size_t threads, bool force,
+    const std::string& cache_dir = std::string(), uintmax_t cache_size = 0) {
+  DeployManifest deploy_manifest = deploy_manifest_of(api, manifest);
+  std::optional<ArtifactCache> cache;
+  if (!cache_dir.empty()) cache.emplace(cache_dir, cache_size);
+  return deploy_manifest.Deploy(items, [api](const DeployManifest::Item& item) {
+    auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+    return item.is_schema
+        ? !!api->deploy_schema(item.file.c_str())
+        : !!api->deploy_config_file(item.file.c_str(), item.version_key.c_str());
+  }, threads ? threads : std::thread::hardware_concurrency(), force,
+     cache ? &*cache : nullptr);
+}
+
+// files whose change redeploys item, user dir paths for missing ones
+inline std::vector<std::filesystem::path> deploy_inputs(RimeApi* api,
+                                                        const DeployManifest::Item& item) {
+  return deploy_manifest_of(api, std::string()).Inputs(item);
+}
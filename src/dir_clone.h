@@ -0,0 +1,141 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+struct CloneStats {
+  uint64_t files = 0;
+  uint64_t cloned = 0;  // shared copy-on-write, by reflink (FICLONE) or clonefile
+  uint64_t linked = 0;  // hardlinked build artifacts
+  uint64_t copied = 0;
+  uint64_t bytes_copied = 0;
+  double seconds = 0;
+};
+
+// copy-on-write copy of one file into a new file to, false when the
+// filesystem has none (nothing is left behind then)
+inline bool reflink_file(const std::filesystem::path& from, const std::filesystem::path& to) {
+#if defined(__linux__) && defined(FICLONE)
+  const int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) return false;
+  struct stat st;
+  const int out = fstat(in, &st) == 0
+      ? ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777) : -1;
+  const bool ok = out >= 0 && ioctl(out, FICLONE, in) == 0;
+  if (out >= 0) ::close(out);
+  ::close(in);
+  if (!ok && out >= 0) ::unlink(to.c_str());
+  return ok;
+#elif defined(__APPLE__)
+  return clonefile(from.c_str(), to.c_str(), CLONE_NOFOLLOW) == 0;
+#else
+  (void)from;
+  (void)to;
+  return false;
+#endif
+}
+
+// Clones a deployed user data dir into dest (which must not exist or be
+// empty) for a worker of its own, without deploying it again. Every file is
+// first reflinked, which shares the blocks until either side writes. Where
+// the filesystem cannot (ext4, tmpfs, across devices), the compiled
+// dictionaries (build/*.bin) are hardlinked and everything else (userdb,
+// user.yaml, staged yaml) is copied with its mtime.
+//
+// Hardlinked files are made read-only, in the template too: librime deletes
+// a dictionary before compiling it again, a rebuild never writes through to
+// the other links, but anything rewriting one in place fails loudly. Pass
+// link_artifacts false to leave a template that is still deployed into
+// untouched.
+//
+// On failure dest is left as it was found: removed if it was created here,
+// emptied otherwise.
+inline bool clone_dir(const std::filesystem::path& src, const std::filesystem::path& dest,
+                      bool link_artifacts, CloneStats* stats, std::string* error) {
+  namespace fs = std::filesystem;
+  const auto start = std::chrono::steady_clock::now();
+  std::error_code ec;
+  if (!fs::is_directory(src, ec)) {
+    *error = "not a directory: " + src.string();
+    return false;
+  }
+  if (fs::exists(dest, ec) && !fs::is_empty(dest, ec)) {
+    *error = "destination is not empty: " + dest.string();
+    return false;
+  }
+  const bool created = fs::create_directories(dest, ec);
+  if (ec) {
+    *error = "failed to create " + dest.string() + ": " + ec.message();
+    return false;
+  }
+  auto fail = [&](const fs::path& path, const std::error_code& e) {
+    *error = "failed to clone " + path.string() + ": " + e.message();
+    std::error_code cleanup_ec;
+    if (created) {
+      fs::remove_all(dest, cleanup_ec);
+      return false;
+    }
+    std::vector<fs::path> entries;
+    for (fs::directory_iterator it(dest, cleanup_ec), end; !cleanup_ec && it != end;
+         it.increment(cleanup_ec))
+      entries.push_back(it->path());
+    for (const auto& entry : entries) fs::remove_all(entry, cleanup_ec);
+    return false;
+  };
+  for (fs::recursive_directory_iterator it(src, ec), end; !ec && it != end; it.increment(ec)) {
+    const fs::path from = it->path();
+    const fs::path rel = from.lexically_relative(src);
+    const fs::path to = dest / rel;
+    std::error_code entry_ec;
+    const fs::file_status status = it->symlink_status(entry_ec);
+    if (fs::is_symlink(status)) {
+      fs::copy_symlink(from, to, entry_ec);
+      if (entry_ec) return fail(from, entry_ec);
+      continue;
+    }
+    if (fs::is_directory(status)) {
+      fs::create_directory(to, entry_ec);
+      if (entry_ec) return fail(from, entry_ec);
+      continue;
+    }
+    if (!fs::is_regular_file(status)) continue;
+    ++stats->files;
+    if (reflink_file(from, to)) {
+      fs::last_write_time(to, fs::last_write_time(from, entry_ec), entry_ec);
+      ++stats->cloned;
+      continue;
+    }
+    const bool artifact = link_artifacts && *rel.begin() == "build" && from.extension() == ".bin";
+    if (artifact) {
+      fs::create_hard_link(from, to, entry_ec);
+      if (!entry_ec) {
+        fs::permissions(to, fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write,
+                        fs::perm_options::remove, entry_ec);
+        ++stats->linked;
+        continue;
+      }
+      entry_ec.clear();  // another device, copy it
+    }
+    if (!fs::copy_file(from, to, entry_ec)) return fail(from, entry_ec);
+    fs::last_write_time(to, fs::last_write_time(from, entry_ec), entry_ec);
+    ++stats->copied;
+    stats->bytes_copied += it->file_size(entry_ec);
+  }
+  if (ec) return fail(src, ec);
+  stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Files written, moved or deleted in a set of directories (not recursive),
+// for the deployer's watch mode. inotify on Linux; elsewhere ok() is false.
+//
+// Wait blocks for the first event, then keeps reading until the dirs have
+// been quiet for the debounce interval, so an editor's save (write to a
+// temp file, rename over, chmod) comes back as one batch with the path
+// listed once.
+class FileWatcher {
+ public:
+  explicit FileWatcher(const std::vector<std::string>& dirs) {
+#ifdef __linux__
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) return;
+    for (const auto& dir : dirs) {
+      const int wd = inotify_add_watch(fd_, dir.c_str(),
+          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+      if (wd >= 0) dirs_[wd] = dir;
+    }
+#else
+    (void)dirs;
+#endif
+  }
+  ~FileWatcher() {
+#ifdef __linux__
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // false when no directory could be watched
+  bool ok() const { return fd_ >= 0 && !dirs_.empty(); }
+  // readable while events are pending
+  int fd() const { return fd_; }
+
+  // changed paths (dir + "/" + name), sorted; empty on timeout. overflow is
+  // set when the kernel dropped events, any file may have changed then.
+  // A negative timeout waits forever.
+  std::vector<std::string> Wait(int debounce_ms, double timeout_seconds, bool* overflow) {
+    std::vector<std::string> changed;
+    *overflow = false;
+#ifdef __linux__
+    if (!ok()) return changed;
+    const int timeout_ms = timeout_seconds < 0 ? -1 : (int)(timeout_seconds * 1000);
+    if (!Poll(timeout_ms)) return changed;
+    do {
+      Read(&changed, overflow);
+    } while (Poll(std::max(0, debounce_ms)));
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+#else
+    (void)debounce_ms;
+    (void)timeout_seconds;
+#endif
+    return changed;
+  }
+
+ private:
+#ifdef __linux__
+  bool Poll(int timeout_ms) {
+    pollfd pfd{fd_, POLLIN, 0};
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+      const int n = poll(&pfd, 1, timeout_ms);
+      if (n > 0) return true;
+      if (n == 0 || errno != EINTR) return false;
+      if (timeout_ms > 0) {
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        timeout_ms = (int)std::max<long long>(0, left);
+      }
+    }
+  }
+  void Read(std::vector<std::string>* changed, bool* overflow) {
+    alignas(inotify_event) char buf[16384];
+    for (;;) {
+      const ssize_t n = read(fd_, buf, sizeof(buf));
+      if (n <= 0) return;
+      for (char* p = buf; p < buf + n;) {
+        const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+        p += sizeof(inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) *overflow = true;
+        if (!event->len || (event->mask & IN_ISDIR)) continue;
+        const auto dir = dirs_.find(event->wd);
+        if (dir != dirs_.end()) changed->push_back(dir->second + "/" + event->name);
+      }
+    }
+  }
+#endif
+
+  int fd_ = -1;
+  std::map<int, std::string> dirs_;
+};
@@ -1,42 +1,86 @@
 #include "lua_export_type.h"
 #include "utils.h"
 #include "line_editor.h"
+#include "mapped_file.h"
+#include "memory_dirs.h"
+#include "deploy_manifest.h"
+#include "dir_clone.h"
+#include "file_watcher.h"
+#include "noti_queue.h"
+#include "prefetch.h"
+#include "resource_usage.h"
+#include "rime_task.h"
+#include "session_locks.h"
+#include "warm_up.h"
+#include <atomic>
+#include <climits>
 #include <cstring>
-#include <unordered_set>
 #ifdef __GNUC__
 #include <cxxabi.h>
 #endif
 
-static std::unordered_set<RimeConfig*> cfg_borrowed_set;
-static std::unordered_set<RimeSchemaList*> schemalist_borrowed_set;
-static std::mutex cfg_borrowed_mutex;
-static std::mutex schemalist_borrowed_mutex;
-
 #define PUSH_VALUE_OR_NIL(L, val, cond, push_func) do {                       \
     if (cond) push_func(L, val); else lua_pushnil(L); } while(0)
-// Thread-safe check wrappers
-static inline bool is_config_borrowed(RimeConfig* cfg) {
-  if (!cfg) return false;
-  std::lock_guard<std::mutex> lk(cfg_borrowed_mutex);
-  return cfg_borrowed_set.find(cfg) != cfg_borrowed_set.end();
+// bumped whenever deployed data may have changed, schema caches compare
+// their generation against it
+static std::atomic<uint64_t> deploy_generation{1};
+static inline void bump_deploy_generation() {
+  deploy_generation.fetch_add(1, std::memory_order_relaxed);
 }
-static inline bool is_schemalist_borrowed(RimeSchemaList* list) {
-  if (!list) return false;
-  std::lock_guard<std::mutex> lk(schemalist_borrowed_mutex);
-  return schemalist_borrowed_set.find(list) != schemalist_borrowed_set.end();
+// schema caches are dropped once the wrapped call returns
+template<lua_CFunction f>
+static int invalidate_schema_cache(lua_State *L) {
+  int ret = f(L);
+  bump_deploy_generation();
+  return ret;
 }
 
-static inline void set_config_borrowed(RimeConfig* cfg, bool borrowed) {
-  if (!cfg) return;
-  std::lock_guard<std::mutex> lk(cfg_borrowed_mutex);
-  if (borrowed)
-    cfg_borrowed_set.insert(cfg);
-  else
-    cfg_borrowed_set.erase(cfg);
+// State of the module inside one lua_State, kept as a userdata in its
+// registry so several VMs (on one thread or many) can load rimeapi_lua.
+// librime itself, the deploy generation and deploy timings are process-wide.
+struct ModuleContext {
+  // own queue, filter and fd; subscribed to the router while a handler is set
+  NotificationSink notifications;
+  int noti_func_ref = LUA_NOREF;
+  // handler gets one array of records per drain instead of one call per message
+  bool noti_batch = false;
+  // set while drain_notifications runs the handlers, the queue must stay put
+  bool noti_draining = false;
+  // reused across drains so popping does not allocate
+  NotificationQueue::Message noti_msg;
+  std::vector<NotificationQueue::Message> noti_coalesced;
+  // created by the first readline call
+  std::unique_ptr<LineEditor> editor;
+  // holds a reference on the process-wide librime
+  bool holds_rime_api = false;
+};
+static const char module_context_key = 0;
+// set up by luaopen_rimeapi_lua, never null afterwards
+static ModuleContext* get_module_context(lua_State* L) {
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &module_context_key);
+  ModuleContext* ctx = (ModuleContext*)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return ctx;
 }
 
-static std::unordered_set<void*> levers_settings_owned;
-static std::mutex levers_settings_mutex;
+// path argument at index, optional codepage at index + 1 (Windows only)
+static const fs::path get_path_from_lua(lua_State* L, int index) {
+  const char* path = luaL_checkstring(L, index);
+  if (!path)
+    return fs::path();
+#ifdef _WIN32
+  unsigned int cp = (lua_gettop(L) > index) ? (unsigned int)luaL_checkinteger(L, index + 1) : CP_UTF8;
+  int len = MultiByteToWideChar(cp, 0, path, -1, nullptr, 0);
+  if (len <= 0)
+    return fs::path();
+  std::wstring wpath(len, L'\0');
+  if(MultiByteToWideChar(cp, 0, path, -1, &wpath[0], len) == 0)
+    return fs::path();
+  return fs::path(wpath);
+#else
+  return fs::path(path);
+#endif
+}
 
 // 为char*添加LuaType特化
 template<>
@@ -117,6 +161,12 @@ struct LuaType<RimeStringSlice> {
 template<typename T>
 struct LuaType<std::shared_ptr<T>> {
   using PtrType = std::shared_ptr<T>;
+  // ownership state lives next to the shared_ptr in the same userdata, so
+  // gc and close never need a global lookup; ptr must stay the first member
+  struct Holder {
+    PtrType ptr;
+    bool borrowed = false;  // data owned by librime/levers, not closed here
+  };
   static const LuaTypeInfo *type() {
     return &LuaTypeInfo::make<LuaType<PtrType>>();
   }
@@ -125,19 +175,16 @@ struct LuaType<std::shared_ptr<T>> {
     std::string demangled_name = LuaType<PtrType>::type()->name();
     printf("%s::%s referenced\n", demangled_name.c_str(), __func__);
 #endif
-    PtrType *p = (PtrType*)luaL_checkudata(L, 1, type()->name());
-    if (p && p->get()) {
+    Holder *h = (Holder*)luaL_checkudata(L, 1, type()->name());
+    if (h && h->ptr.get()) {
+      PtrType *p = &h->ptr;
 #define CHECKT(t) (std::is_same<T, t>::value)
       // free the underlying resource if needed, not free the shared_ptr itself
       if constexpr CHECKT(RimeConfig){
-        if (!is_config_borrowed(p->get()))
-          RIMEAPI->config_close(p->get());
-        {
-          std::lock_guard<std::mutex> lk(cfg_borrowed_mutex);
-          cfg_borrowed_set.erase(p->get());
-        }
+        if (!h->borrowed)
+          serialized<SessionLocks::kGlobal>(RIMEAPI->config_close)(p->get());
       } else if constexpr CHECKT(RimeConfigIterator) {
-        RIMEAPI->config_end(p->get());
+        serialized<SessionLocks::kGlobal>(RIMEAPI->config_end)(p->get());
       } else if constexpr CHECKT(RimeStatus) {
         RIMEAPI->free_status(p->get());
       } else if constexpr CHECKT(RimeContext) {
@@ -145,16 +192,11 @@ struct LuaType<std::shared_ptr<T>> {
       } else if constexpr CHECKT(RimeCommit) {
         RIMEAPI->free_commit(p->get());
       } else if constexpr CHECKT(RimeSchemaList) {
-        bool borrowed = is_schemalist_borrowed(p->get());
-        const auto deleter = borrowed ? RIMELEVERSAPI->schema_list_destroy : RIMEAPI->free_schema_list;
-        deleter(p->get());
-        {
-          std::lock_guard<std::mutex> lk(schemalist_borrowed_mutex);
-          schemalist_borrowed_set.erase(p->get());
-        }
+        const auto deleter = h->borrowed ? RIMELEVERSAPI->schema_list_destroy : RIMEAPI->free_schema_list;
+        serialized<SessionLocks::kGlobal>(deleter)(p->get());
       }
 #undef CHECKT
-      p->~PtrType();
+      h->~Holder();
     }
     return 0;
   }
@@ -163,8 +205,8 @@ struct LuaType<std::shared_ptr<T>> {
       lua_pushnil(L);
       return;
     }
-    void *u = lua_newuserdata(L, sizeof(PtrType));
-    new(u) PtrType(t);
+    void *u = lua_newuserdata(L, sizeof(Holder));
+    new(u) Holder{t};
 
     luaL_getmetatable(L, type()->name());
     if (lua_isnil(L, -1)) {
@@ -178,11 +220,26 @@ struct LuaType<std::shared_ptr<T>> {
     lua_setmetatable(L, -2);
   }
   static PtrType &todata(lua_State *L, int i, C_State* = NULL) {
-    PtrType *p = (PtrType*)luaL_checkudata(L, i, type()->name());
-    return *p;
+    Holder *h = (Holder*)luaL_checkudata(L, i, type()->name());
+    return h->ptr;
+  }
+  // nullptr unless the value at i is a shared_ptr userdata of this type
+  static Holder *holder(lua_State *L, int i) {
+    return (Holder*)luaL_testudata(L, i, type()->name());
   }
 };
 
+template <typename T>
+static bool is_borrowed(lua_State *L, int index) {
+  auto *h = LuaType<std::shared_ptr<T>>::holder(L, index);
+  return h && h->borrowed;
+}
+template <typename T>
+static void set_borrowed(lua_State *L, int index, bool borrowed) {
+  if (auto *h = LuaType<std::shared_ptr<T>>::holder(L, index))
+    h->borrowed = borrowed;
+}
+
 template <typename T>
 static T* smart_shared_ptr_todata(lua_State *L, int index = 1) {
   // Return nullptr if the Lua value at index is nil
@@ -586,7 +643,7 @@ namespace RimeConfigReg {
     T* t = smart_shared_ptr_todata<T>(L); \
     const char* key = luaL_checkstring(L, 2); \
     value_type value; \
-    PUSH_VALUE_OR_NIL(L, value, RIMEAPI->config_##name(t, key, &value), pushfunc); \
+    PUSH_VALUE_OR_NIL(L, value, serialized<SessionLocks::kGlobal>(RIMEAPI->config_##name)(t, key, &value), pushfunc); \
     return 1; \
   }
 #define DEFINE_SET_METHOD(name, value_type, checkfunc) \
@@ -594,7 +651,7 @@ namespace RimeConfigReg {
     T* t = smart_shared_ptr_todata<T>(L); \
     const char* key = luaL_checkstring(L, 2); \
     value_type value = checkfunc(L, 3); \
-    bool ret = RIMEAPI->config_##name(t, key, value); \
+    bool ret = serialized<SessionLocks::kGlobal>(RIMEAPI->config_##name)(t, key, value); \
     lua_pushboolean(L, ret); \
     return 1; \
   }
@@ -606,11 +663,11 @@ namespace RimeConfigReg {
     } else {
       const char *new_config_id = lua_tostring(L, 2);
       if (RimeApi *api = RIMEAPI) {
-        bool was_borrowed = is_config_borrowed(t);
+        bool was_borrowed = is_borrowed<T>(L, 1);
         if (!was_borrowed)
-          api->config_close(t);
-        Bool ok = api->config_open(new_config_id, t);
-        set_config_borrowed(t, was_borrowed && !ok);
+          serialized<SessionLocks::kGlobal>(api->config_close)(t);
+        Bool ok = serialized<SessionLocks::kGlobal>(api->config_open)(new_config_id, t);
+        set_borrowed<T>(L, 1, was_borrowed && !ok);
         lua_pushboolean(L, !!ok);
       } else
         lua_pushboolean(L, false);
@@ -621,16 +678,28 @@ namespace RimeConfigReg {
     T* t = smart_shared_ptr_todata<T>(L);
     bool ret = false;
     if (t) {
-      if (is_config_borrowed(t)) {
+      if (is_borrowed<T>(L, 1)) {
         ret = false;
       } else {
-        ret = RIMEAPI->config_close(t);
-        set_config_borrowed(t, false);
+        ret = serialized<SessionLocks::kGlobal>(RIMEAPI->config_close)(t);
       }
     }
     lua_pushboolean(L, ret);
     return 1;
   }
+  // map the file and hand the bytes to librime directly, no Lua string copy
+  static int load_file(lua_State* L) {
+    T* t = smart_shared_ptr_todata<T>(L);
+    const fs::path path = get_path_from_lua(L, 2);
+    bool ret = false;
+    if (t && !path.empty()) {
+      MappedFile file(path);
+      if (file.ok())
+        ret = serialized<SessionLocks::kGlobal>(RIMEAPI->config_load_string)(t, file.c_str());
+    }
+    lua_pushboolean(L, ret);
+    return 1;
+  }
   static int get_string(lua_State* L) {
     T* t = smart_shared_ptr_todata<T>(L);
     const char* key = luaL_checkstring(L, 2);
@@ -638,13 +707,13 @@ namespace RimeConfigReg {
     if (lua_gettop(L) > 2)
       buffer_size = luaL_checkinteger(L, 3);
     std::unique_ptr<char[]> buffer = std::make_unique<char[]>(buffer_size);
-    PUSH_VALUE_OR_NIL(L, buffer.get(), RIMEAPI->config_get_string(t, key, buffer.get(), buffer_size), lua_pushstring);
+    PUSH_VALUE_OR_NIL(L, buffer.get(), serialized<SessionLocks::kGlobal>(RIMEAPI->config_get_string)(t, key, buffer.get(), buffer_size), lua_pushstring);
     return 1;
   }
   static int get_cstring(lua_State* L) {
     T* t = smart_shared_ptr_todata<T>(L);
     const char* key = luaL_checkstring(L, 2);
-    const char* value = RIMEAPI->config_get_cstring(t, key);
+    const char* value = serialized<SessionLocks::kGlobal>(RIMEAPI->config_get_cstring)(t, key);
     PUSH_VALUE_OR_NIL(L, value, value != nullptr, lua_pushstring);
     return 1;
   }
@@ -663,6 +732,7 @@ namespace RimeConfigReg {
     {"open", reload},
     {"reload", reload},
     {"close", close},
+    {"load_file", load_file},
     {"get_int", get_int},
     {"get_string", get_string},
     {"get_bool", get_bool},
@@ -755,18 +825,62 @@ namespace RimeSchemaListItemReg {
 namespace RimeSchemaListReg {
   using T = RimeSchemaList;
 
+  // the list userdata's user value caches its Lua side:
+  // { generation = <deploy generation of the fill>, items = {...} }
+  // generation is 0 when the list was not filled by get_schema_list
+  static void reset_cache(lua_State* L, int idx, uint64_t generation = 0) {
+    idx = lua_absindex(L, idx);
+    if (lua_type(L, idx) != LUA_TUSERDATA) return;
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, (lua_Integer)generation);
+    lua_setfield(L, -2, "generation");
+    lua_setiuservalue(L, idx, 1);
+  }
+  static bool is_cache_fresh(lua_State* L, int idx, uint64_t generation) {
+    bool fresh = false;
+    if (lua_getiuservalue(L, idx, 1) == LUA_TTABLE) {
+      lua_getfield(L, -1, "generation");
+      fresh = (uint64_t)lua_tointeger(L, -1) == generation;
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return fresh;
+  }
+
   // get a table of LuaType<RimeSchemaListItem>
   static int list(lua_State* L) {
     // return a table of RimeSchemaListItem
     // Accept either value userdata or shared_ptr userdata
     T* tp = smart_shared_ptr_todata<T>(L, 1);
     lua_newtable(L);
-    if (tp && tp->list) {
-      for (size_t i = 0; i < tp->size; ++i) {
-        LuaType<RimeSchemaListItem>::pushdata(L, tp->list[i]);
-        lua_rawseti(L, -2, (lua_Integer)(i + 1));  // 使用1-based索引给 Lua
+    if (!tp || !tp->list)
+      return 1;
+    // items built since the last fill are reused, callers get a shallow copy
+    bool has_cache = false;
+    if (lua_type(L, 1) == LUA_TUSERDATA) {
+      has_cache = lua_getiuservalue(L, 1, 1) == LUA_TTABLE;
+      if (!has_cache) lua_pop(L, 1);
+    }
+    if (has_cache && lua_getfield(L, -1, "items") == LUA_TTABLE) {
+      for (size_t i = 1; i <= tp->size; ++i) {
+        lua_rawgeti(L, -1, (lua_Integer)i);
+        lua_rawseti(L, -4, (lua_Integer)i);
       }
+      lua_pop(L, 2);
+      return 1;
+    }
+    if (has_cache) lua_pop(L, 1);   // nil items, keep the cache table
+    lua_createtable(L, (int)tp->size, 0);
+    for (size_t i = 0; i < tp->size; ++i) {
+      LuaType<RimeSchemaListItem>::pushdata(L, tp->list[i]);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, -3, (lua_Integer)(i + 1));
+      lua_rawseti(L, has_cache ? -4 : -3, (lua_Integer)(i + 1));  // 使用1-based索引给 Lua
+    }
+    if (has_cache) {
+      lua_setfield(L, -2, "items");
     }
+    lua_pop(L, 1);
     return 1;
   }
 
@@ -808,6 +922,8 @@ namespace RimeStringSliceReg {
   static constexpr const char name##_func_name[] = #name;
 // Macro to create function pointer wrappers, with function name info
 #define WRAP_API_FUNC(func) call_function_pointer<&T::func, func##_func_name>
+// for calls which change deployed data or schema selection
+#define WRAP_DEPLOY_FUNC(func) invalidate_schema_cache<WRAP_API_FUNC(func)>
 // Macro to check function signature
 #define SIGNATURE_CHECK(ret, ...) (std::is_same_v<FuncType, ret(*)(__VA_ARGS__)>)
 
@@ -1084,48 +1200,150 @@ namespace RimeApiReg {
   DECLARE_FUNC_NAME_VAR(get_staging_dir_s)
   DECLARE_FUNC_NAME_VAR(get_sync_dir_s)
 
-  static vector<RimeSessionId> sessionid;
-  static vector<string> msg_type;
-  static vector<string> msg_value;
-
-  static std::mutex noti_mutex;
+  // process-wide: librime has one handler, every lua_State with a Lua
+  // handler set gets its own copy of each message through the router
+  static NotificationRouter noti_router;
+  static DeployTimer deploy_timer;
+  // async tasks keep on_message installed for deploy_timer without any
+  // subscriber, then nothing is queued
+  static std::atomic<int> running_tasks{0};
+  static std::mutex noti_handler_mutex;
   static void on_message(void* context_object,
       RimeSessionId session_id,
       const char* message_type,
       const char* message_value) {
-    const std::string message_type_str = message_type ? message_type : "";
-    const std::string message_value_str = message_value ? message_value : "";
-    {
-      std::lock_guard<std::mutex> lock(noti_mutex);
-      sessionid.push_back(session_id);
-      msg_type.push_back(message_type_str);
-      msg_value.push_back(message_value_str);
+    if (message_type && strcmp(message_type, "deploy") == 0) {
+      bump_deploy_generation();
+      deploy_timer.OnDeploy(message_value);
     }
+    noti_router.Dispatch(session_id, message_type, message_value);
+  }
+  // installs on_message while anyone needs it; VMs on other threads may
+  // subscribe concurrently, hence the lock
+  static void update_notification_handler() {
+    std::lock_guard<std::mutex> lock(noti_handler_mutex);
+    if (!RIMEAPI) return;
+    const bool needed = noti_router.size() > 0 || running_tasks.load() > 0;
+    RIMEAPI->set_notification_handler(needed ? on_message : nullptr, nullptr);
+  }
+
+  // { types = { 'deploy', ... }, sessions = { session, ... }, coalesce = true }
+  // at idx; returns an error message instead of raising so the vectors are
+  // not skipped by longjmp
+  static const char* read_notification_filter(lua_State *L, int idx,
+      std::unique_ptr<NotificationFilter>* out) {
+    std::vector<std::string> types;
+    std::vector<RimeSessionId> sessions;
+    bool coalesce = false;
+    lua_getfield(L, idx, "types");
+    if (lua_istable(L, -1)) {
+      for (lua_Integer i = 1; lua_rawgeti(L, -1, i) != LUA_TNIL; ++i) {
+        if (lua_type(L, -1) != LUA_TSTRING) {
+          lua_pop(L, 2);
+          return "types must be a list of strings";
+        }
+        types.emplace_back(lua_tostring(L, -1));
+        lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+    } else if (!lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      return "types must be a list of strings";
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, idx, "sessions");
+    if (lua_istable(L, -1)) {
+      for (lua_Integer i = 1; lua_rawgeti(L, -1, i) != LUA_TNIL; ++i) {
+        if (lua_isinteger(L, -1)) {
+          sessions.push_back((RimeSessionId)lua_tointeger(L, -1));
+        } else if (auto *s = (RimeSessionStruct*)luaL_testudata(L, -1, "RimeSession")) {
+          sessions.push_back(s->id);
+        } else {
+          lua_pop(L, 2);
+          return "sessions must be a list of RimeSession or integer";
+        }
+        lua_pop(L, 1);
+      }
+      lua_pop(L, 1);
+    } else if (!lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      return "sessions must be a list of RimeSession or integer";
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, idx, "coalesce");
+    coalesce = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if (!types.empty() || !sessions.empty() || coalesce)
+      *out = std::make_unique<NotificationFilter>(std::move(types),
+                                                  std::move(sessions), coalesce);
+    return nullptr;
   }
 
-  int noti_func_ref = LUA_NOREF;
   // Lua wrapper for set_notification_handler
+  // api:set_notification_handler(func [, capacity | options]) -> true | false, error
+  // options: { capacity=, batch=, types=, sessions=, coalesce= }
+  // capacity is at most NotificationQueue::kMaxCapacity (1 << 20); queued
+  // messages move to the new queue. A new capacity is refused inside a
+  // handler, the queue being drained can not be replaced; nothing changes
+  // then and the call may be retried
   static int lua_set_notification_handler(lua_State *L) {
-    T* api = smart_shared_ptr_todata<T>(L, 1);
+    smart_shared_ptr_todata<T>(L, 1);
+    ModuleContext* ctx = get_module_context(L);
+    NotificationSink& sink = ctx->notifications;
     // cache function on Lua stack index 2
     if (lua_isfunction(L, 2)) {
-      api->set_notification_handler(on_message, nullptr);
+      lua_Integer capacity = 0;
+      bool batch = false;
+      std::unique_ptr<NotificationFilter> filter;
+      if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "capacity");
+        capacity = luaL_optinteger(L, -1, 0);
+        lua_getfield(L, 3, "batch");
+        batch = lua_toboolean(L, -1);
+        lua_pop(L, 2);
+        luaL_argcheck(L, capacity >= 0 && (size_t)capacity <= NotificationQueue::kMaxCapacity, 3,
+                      "capacity out of range");
+        if (const char* err = read_notification_filter(L, 3, &filter))
+          return luaL_argerror(L, 3, err);
+      } else {
+        capacity = luaL_optinteger(L, 3, 0);
+        luaL_argcheck(L, capacity >= 0 && (size_t)capacity <= NotificationQueue::kMaxCapacity, 3,
+                      "capacity out of range");
+      }
+      const bool resize = capacity > 0 && (size_t)capacity != sink.queue->capacity();
+      if (resize && ctx->noti_draining) {
+        filter.reset();
+        lua_pushboolean(L, false);
+        lua_pushliteral(L, "capacity can not change while notifications are drained");
+        return 2;
+      }
+      // the router keeps librime threads off the filter and the queue while
+      // they are replaced
+      noti_router.ResetFilter(&sink, std::move(filter));
+      if (resize)
+        noti_router.ResizeQueue(&sink, (size_t)capacity);
       // remove previous reference if any
-      if (noti_func_ref != LUA_NOREF) {
-        luaL_unref(L, LUA_REGISTRYINDEX, noti_func_ref);
-        noti_func_ref = LUA_NOREF;
+      if (ctx->noti_func_ref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ctx->noti_func_ref);
+        ctx->noti_func_ref = LUA_NOREF;
       }
       lua_pushvalue(L, 2); // copy function to top of stack
-      noti_func_ref = luaL_ref(L, LUA_REGISTRYINDEX); // store reference
+      ctx->noti_func_ref = luaL_ref(L, LUA_REGISTRYINDEX); // store reference
+      ctx->noti_batch = batch;
+      noti_router.Subscribe(&sink);
+      update_notification_handler();
     } else {
-      api->set_notification_handler(nullptr, nullptr);
+      noti_router.Unsubscribe(&sink);
+      update_notification_handler();
+      noti_router.ResetFilter(&sink);
       // remove previous reference if any
-      if (noti_func_ref != LUA_NOREF) {
-        luaL_unref(L, LUA_REGISTRYINDEX, noti_func_ref);
-        noti_func_ref = LUA_NOREF;
+      if (ctx->noti_func_ref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, ctx->noti_func_ref);
+        ctx->noti_func_ref = LUA_NOREF;
       }
     }
-    return 0;
+    lua_pushboolean(L, true);
+    return 1;
   }
 
   static int lua_traceback(lua_State *L) {
@@ -1144,45 +1362,789 @@ namespace RimeApiReg {
     return 1;
   }
 
-  static int drain_notifications(lua_State *L) {
-    std::lock_guard<std::mutex> lock(noti_mutex);
-    if (noti_func_ref != LUA_NOREF && !sessionid.empty()) {
-      T* api = smart_shared_ptr_todata<T>(L);
-      for (size_t i = 0; i < msg_type.size(); ++i) {
-        /* push the callback function from registry */
-        lua_rawgeti(L, LUA_REGISTRYINDEX, noti_func_ref);   /* +1: func */
-        /* push arguments as before */
+  static int drain_notifications_protected(lua_State *L) {
+    ModuleContext* ctx = get_module_context(L);
+    NotificationQueue::Message& msg = ctx->noti_msg;
+    std::vector<NotificationQueue::Message>& coalesced = ctx->noti_coalesced;
+    NotificationQueue& queue = *ctx->notifications.queue;
+    NotificationFilter* filter = ctx->notifications.filter.get();
+    ctx->notifications.signal.Rearm();
+    if (ctx->noti_func_ref == LUA_NOREF) {
+      // nobody listens, just discard
+      while (queue.Pop(&msg)) {}
+      if (filter) filter->TakeCoalesced(&coalesced);
+      return 0;
+    }
+    // messages posted by the callbacks themselves wait for the next drain;
+    // coalesced option values go after the queued ones as the latest state
+    size_t pending = queue.size();
+    const size_t ncoalesced = filter ? filter->TakeCoalesced(&coalesced) : 0;
+    if (pending == 0 && ncoalesced == 0) return 0;
+    size_t next_coalesced = 0;
+    const auto next = [&]() -> const NotificationQueue::Message* {
+      if (pending > 0) {
+        --pending;
+        if (queue.Pop(&msg)) return &msg;
+        pending = 0;  // a producer was still writing the slot
+      }
+      return next_coalesced < ncoalesced ? &coalesced[next_coalesced++] : nullptr;
+    };
+    /* error handler stays installed for the whole drain:
+       ... errfunc func args... so that errfunc index = base */
+    lua_pushcfunction(L, lua_traceback);
+    const int base = lua_gettop(L);
+    /* the handler as of now: one setting another handler or nil keeps
+       getting the rest of this drain */
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->noti_func_ref);
+    const int func = lua_gettop(L);
+    if (ctx->noti_batch) {
+      /* one call: handler(nil, { {session=, type=, value=, timestamp=}, ... }) */
+      lua_pushvalue(L, func);
+      lua_pushnil(L);
+      lua_createtable(L, (int)(pending + ncoalesced), 0);
+      const int records = lua_gettop(L);
+      // consecutive messages mostly come from the same session, share its userdata
+      lua_newtable(L);
+      const int sessions = lua_gettop(L);
+      lua_Integer n = 0;
+      while (const NotificationQueue::Message* m = next()) {
+        lua_createtable(L, 0, 4);
+        const lua_Integer key = (lua_Integer)m->session_id;
+        if (lua_rawgeti(L, sessions, key) == LUA_TNIL) {
+          lua_pop(L, 1);
+          RimeSession_pushdata(L, m->session_id);
+          lua_pushvalue(L, -1);
+          lua_rawseti(L, sessions, key);
+        }
+        lua_setfield(L, -2, "session");
+        lua_pushlstring(L, m->type.data(), m->type.size());
+        lua_setfield(L, -2, "type");
+        lua_pushlstring(L, m->value.data(), m->value.size());
+        lua_setfield(L, -2, "value");
+        lua_pushnumber(L, (lua_Number)m->timestamp / 1e9);
+        lua_setfield(L, -2, "timestamp");
+        lua_rawseti(L, records, ++n);
+      }
+      lua_settop(L, records);
+      if (n == 0) {
+        lua_settop(L, func);
+      } else if (lua_pcall(L, 2, 0, base) != LUA_OK) {
+        const char *err = lua_tostring(L, -1);
+        printf("err: %s\n", err ? err : "(error object not a string)");
+        lua_pop(L, 1);
+      }
+    } else {
+      while (const NotificationQueue::Message* m = next()) {
+        lua_pushvalue(L, func);                             /* +1: func */
         lua_pushnil(L);                                     /* +1: context arg (nil) */
-        RimeSession_pushdata(L, sessionid.at(i));          /* +1: session */
-        lua_pushstring(L, msg_type.at(i).c_str());         /* +1: type */
-        lua_pushstring(L, msg_value.at(i).c_str());        /* +1: value */
-        int nargs = 4;
-        /* prepare error handler: insert it below the function and its args.
-           Lua stack layout before insert: ... func arg1 arg2 arg3 arg4
-           We want: ... errfunc func arg1 arg2 arg3 arg4
-           so that errfunc index = base (for lua_pcall) */
-        int base = lua_gettop(L) - nargs; /* base = index where func sits */
-        /* push error handler (C function) */
-        lua_pushcfunction(L, lua_traceback); /* +1: errfunc */
-        /* move errfunc to position 'base' (below func and args) */
-        lua_insert(L, base);
+        RimeSession_pushdata(L, m->session_id);            /* +1: session */
+        lua_pushlstring(L, m->type.data(), m->type.size());   /* +1: type */
+        lua_pushlstring(L, m->value.data(), m->value.size()); /* +1: value */
+        lua_pushnumber(L, (lua_Number)m->timestamp / 1e9);    /* +1: timestamp */
         /* call protected with errfunc at index 'base' */
-        if (lua_pcall(L, nargs, 0, base) != LUA_OK) {
+        if (lua_pcall(L, 5, 0, base) != LUA_OK) {
           const char *err = lua_tostring(L, -1);
           /* err contains traceback produced by lua_traceback */
           printf("err: %s\n", err ? err : "(error object not a string)");
           lua_pop(L, 1); /* pop error */
         }
-        /* remove the error handler from the stack (it was at position 'base') */
-        lua_remove(L, base); /* note: after pcall it may not be present if pcall cleaned it, but lua_remove is safe */
-        /* continue next message */
       }
     }
-    std::vector<std::string>().swap(msg_type);
-    std::vector<std::string>().swap(msg_value);
-    std::vector<RimeSessionId>().swap(sessionid);
+    lua_pop(L, 2); /* pop the handler and the error handler */
+    return 0;
+  }
+  static int drain_notifications(lua_State *L) {
+    ModuleContext* ctx = get_module_context(L);
+    // a handler calling drain_notifications again gets nothing
+    if (ctx->noti_draining) return 0;
+    // building the records may raise (memory errors outside the handler
+    // pcalls), the flag is reset before the error goes on
+    ctx->noti_draining = true;
+    lua_pushcfunction(L, drain_notifications_protected);
+    const int status = lua_pcall(L, 0, 0, 0);
+    ctx->noti_draining = false;
+    if (status != LUA_OK) return lua_error(L);
+    return 0;
+  }
+
+  // api:set_concurrency_mode(enabled) -> previous mode
+  // process-wide; serializes librime calls made from several threads, see
+  // SessionLocks for which calls are serialized per session and which globally.
+  // Switch it before other threads start using librime
+  static int set_concurrency_mode(lua_State *L) {
+    smart_shared_ptr_todata<T>(L, 1);
+    lua_pushboolean(L, SessionLocks::Shared().set_enabled(lua_toboolean(L, 2)));
+    return 1;
+  }
+  static int get_concurrency_mode(lua_State *L) {
+    lua_pushboolean(L, SessionLocks::Shared().enabled());
+    return 1;
+  }
+
+  // api:get_steady_time() -> seconds on the clock of notification timestamps
+  static int get_steady_time(lua_State *L) {
+    lua_pushnumber(L, (lua_Number)NotificationQueue::Now() / 1e9);
+    return 1;
+  }
+
+  // api:get_deploy_timings([clear])
+  //   -> { { start=, finish=, duration=, result='success'|'failure' }, ... }
+  // one record per deploy run seen since the handler was installed, seconds
+  static int get_deploy_timings(lua_State *L) {
+    const bool clear = lua_toboolean(L, 2);
+    const std::vector<DeployTimer::Run> runs = deploy_timer.Runs(clear);
+    lua_createtable(L, (int)runs.size(), 0);
+    for (size_t i = 0; i < runs.size(); ++i) {
+      const DeployTimer::Run& run = runs[i];
+      lua_createtable(L, 0, 4);
+      lua_pushnumber(L, (lua_Number)run.start / 1e9);
+      lua_setfield(L, -2, "start");
+      lua_pushnumber(L, (lua_Number)run.finish / 1e9);
+      lua_setfield(L, -2, "finish");
+      lua_pushnumber(L, (lua_Number)(run.finish - run.start) / 1e9);
+      lua_setfield(L, -2, "duration");
+      lua_pushstring(L, run.success ? "success" : "failure");
+      lua_setfield(L, -2, "result");
+      lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    return 1;
+  }
+
+  // api:get_notification_fd() -> integer | nil
+  // readable once notifications arrive after the last drain_notifications,
+  // poll it and drain instead of draining after every call
+  static int get_notification_fd(lua_State *L) {
+    NotificationSink& sink = get_module_context(L)->notifications;
+    const int fd = sink.signal.fd([&sink]() {
+      return sink.queue->size() + sink.filter.pending() > 0;
+    });
+    PUSH_VALUE_OR_NIL(L, (lua_Integer)fd, fd >= 0, lua_pushinteger);
+    return 1;
+  }
+
+  // api:get_notification_stats()
+  //   -> { capacity, pending, dropped, overflowed, filtered, coalesced }
+  static int get_notification_stats(lua_State *L) {
+    const NotificationSink& sink = get_module_context(L)->notifications;
+    const NotificationQueue& queue = *sink.queue;
+    const NotificationFilterSlot& filter = sink.filter;
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, (lua_Integer)queue.capacity());
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, (lua_Integer)(queue.size() + filter.pending()));
+    lua_setfield(L, -2, "pending");
+    lua_pushinteger(L, (lua_Integer)queue.dropped());
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, (lua_Integer)queue.overflowed());
+    lua_setfield(L, -2, "overflowed");
+    lua_pushinteger(L, (lua_Integer)filter.filtered());
+    lua_setfield(L, -2, "filtered");
+    lua_pushinteger(L, (lua_Integer)filter.coalesced());
+    lua_setfield(L, -2, "coalesced");
+    return 1;
+  }
+
+  // RimeTask handle: { done()/ready(), wait([timeout]), result(), fd() },
+  // returned by the *_async deploy methods and by api:async
+  static const char kRimeTaskType[] = "RimeTask";
+  struct TaskHandle {
+    enum Kind { kDeploy, kBool, kInteger };
+    RimeTask* task;  // owned, deploy tasks only
+    std::shared_ptr<Completion> completion;
+    Kind kind;
+  };
+  static TaskHandle* check_task(lua_State *L, int idx) {
+    TaskHandle* h = (TaskHandle*)luaL_checkudata(L, idx, kRimeTaskType);
+    luaL_argcheck(L, h->completion != nullptr, idx, "RimeTask already closed");
+    return h;
+  }
+  static int push_task_result(lua_State *L, TaskHandle* h) {
+    const int64_t value = h->completion->value();
+    switch (h->kind) {
+      case TaskHandle::kDeploy:
+        lua_pushboolean(L, value != RimeTask::kFailure);
+        lua_pushstring(L, RimeTask::ResultName((RimeTask::Result)value));
+        return 2;
+      case TaskHandle::kBool:
+        lua_pushboolean(L, value != 0);
+        return 1;
+      default:
+        lua_pushinteger(L, (lua_Integer)value);
+        return 1;
+    }
+  }
+  // continuation of task_wait in a coroutine: stack is task, timeout,
+  // deadline, then whatever resume passed
+  static int task_wait_k(lua_State *L, int status, lua_KContext ctx) {
+    (void)status;
+    (void)ctx;
+    lua_settop(L, 3);
+    TaskHandle* h = check_task(L, 1);
+    if (h->completion->done())
+      return push_task_result(L, h);
+    const lua_Number deadline = lua_tonumber(L, 3);
+    if (deadline >= 0 && (lua_Number)NotificationQueue::Now() / 1e9 >= deadline) {
+      lua_pushnil(L);
+      lua_pushliteral(L, "timeout");
+      return 2;
+    }
+    lua_pushvalue(L, 1);
+    return lua_yieldk(L, 1, 0, task_wait_k);
+  }
+  // task:wait([timeout]) -> result of the call, or nil, 'timeout'
+  // blocks outside a coroutine. Inside one it yields the task instead and
+  // nothing resumes it by itself: the caller's scheduler resumes the
+  // coroutine, typically once task:fd() polls readable, and every resume
+  // yields again while the task runs
+  static int task_wait(lua_State *L) {
+    TaskHandle* h = check_task(L, 1);
+    const lua_Number timeout = luaL_optnumber(L, 2, -1);
+    if (!h->completion->done() && lua_isyieldable(L)) {
+      lua_settop(L, 2);
+      lua_pushnumber(L, timeout < 0 ? -1 : (lua_Number)NotificationQueue::Now() / 1e9 + timeout);
+      return task_wait_k(L, LUA_YIELD, 0);
+    }
+    if (!h->completion->Wait(timeout)) {
+      lua_pushnil(L);
+      lua_pushliteral(L, "timeout");
+      return 2;
+    }
+    return push_task_result(L, h);
+  }
+  static int task_done(lua_State *L) {
+    lua_pushboolean(L, check_task(L, 1)->completion->done());
+    return 1;
+  }
+  // nil while running
+  static int task_result(lua_State *L) {
+    TaskHandle* h = check_task(L, 1);
+    if (!h->completion->done()) return 0;
+    return push_task_result(L, h);
+  }
+  // integer | nil, readable once the task is done
+  static int task_fd(lua_State *L) {
+    const int fd = check_task(L, 1)->completion->fd();
+    PUSH_VALUE_OR_NIL(L, (lua_Integer)fd, fd >= 0, lua_pushinteger);
+    return 1;
+  }
+  static int task_gc(lua_State *L) {
+    TaskHandle* h = (TaskHandle*)luaL_checkudata(L, 1, kRimeTaskType);
+    delete h->task;  // detaches a running deploy; pool jobs only share the completion
+    h->~TaskHandle();
+    return 0;
+  }
+  static TaskHandle* new_task_handle(lua_State *L, TaskHandle::Kind kind) {
+    TaskHandle* h = (TaskHandle*)lua_newuserdata(L, sizeof(TaskHandle));
+    new(h) TaskHandle{nullptr, nullptr, kind};
+    if (luaL_newmetatable(L, kRimeTaskType)) {
+      static const luaL_Reg task_methods[] = {
+        {"wait", task_wait},
+        {"done", task_done},
+        {"ready", task_done},
+        {"result", task_result},
+        {"fd", task_fd},
+        {nullptr, nullptr}
+      };
+      luaL_newlib(L, task_methods);
+      lua_setfield(L, -2, "__index");
+      lua_pushcfunction(L, task_gc);
+      lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return h;
+  }
+  // work off the Lua thread is serialized by SessionLocks, which lock nothing
+  // with concurrency mode off; call before building anything, it raises
+  static void check_concurrency_mode(lua_State *L, const char* what) {
+    if (!SessionLocks::Shared().enabled())
+      luaL_error(L, "%s need concurrency mode, see api:set_concurrency_mode", what);
+  }
+  static void push_task(lua_State *L, std::function<RimeTask::Result()> work) {
+    TaskHandle* h = new_task_handle(L, TaskHandle::kDeploy);
+    // deploy_timer and the generation bump need on_message even without a Lua handler
+    if (running_tasks.fetch_add(1) == 0)
+      update_notification_handler();
+    h->task = new RimeTask([work]() {
+      const RimeTask::Result result = work();
+      bump_deploy_generation();
+      if (--running_tasks == 0)
+        update_notification_handler();
+      return result;
+    });
+    h->completion = h->task->completion();
+  }
+  // job runs on the shared WorkerPool; arguments are copied, no Lua value
+  // or userdata is touched off the Lua thread
+  static void push_pool_job(lua_State *L, TaskHandle::Kind kind, std::function<int64_t()> job) {
+    TaskHandle* h = new_task_handle(L, kind);
+    h->completion = std::make_shared<Completion>();
+    WorkerPool::PostShared([completion = h->completion, job]() {
+      completion->Set(job());
+    });
+  }
+  // api:async(method, ...) -> RimeTask whose result is what the synchronous
+  // method returns: sync_user_data, select_schema, and the levers user dict
+  // calls backup_user_dict, export_user_dict, import_user_dict; raises
+  // without concurrency mode
+  static int async_call(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* method = luaL_checkstring(L, 2);
+    check_concurrency_mode(L, "async calls");
+    // check every argument before building the captures, luaL errors
+    // would skip their destructors
+    if (strcmp(method, "sync_user_data") == 0) {
+      push_pool_job(L, TaskHandle::kBool, [api]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return api->sync_user_data();
+      });
+    } else if (strcmp(method, "select_schema") == 0) {
+      const RimeSessionId session_id = RimeSession_todata(L, 3);
+      const char* schema_id = luaL_checkstring(L, 4);
+      push_pool_job(L, TaskHandle::kBool, [api, session_id, id = std::string(schema_id)]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return api->select_schema(session_id, id.c_str());
+      });
+    } else if (strcmp(method, "backup_user_dict") == 0) {
+      const char* dict_name = luaL_checkstring(L, 3);
+      RimeLeversApi* levers = RIMELEVERSAPI;
+      push_pool_job(L, TaskHandle::kBool, [levers, name = std::string(dict_name)]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return levers->backup_user_dict(name.c_str());
+      });
+    } else if (strcmp(method, "export_user_dict") == 0 ||
+               strcmp(method, "import_user_dict") == 0) {
+      const bool is_export = method[0] == 'e';
+      const char* dict_name = luaL_checkstring(L, 3);
+      const char* text_file = luaL_checkstring(L, 4);
+      RimeLeversApi* levers = RIMELEVERSAPI;
+      push_pool_job(L, TaskHandle::kInteger,
+          [levers, is_export, name = std::string(dict_name), file = std::string(text_file)]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return is_export ? levers->export_user_dict(name.c_str(), file.c_str())
+                         : levers->import_user_dict(name.c_str(), file.c_str());
+      });
+    } else {
+      return luaL_argerror(L, 2, "unsupported method for async");
+    }
+    return 1;
+  }
+
+  // api:start_maintenance_async(full_check) -> RimeTask
+  // like the other deploy tasks, raises without concurrency mode; the task
+  // holds the global lock shared, sessions are served while it runs
+  static int start_maintenance_async(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const bool full_check = lua_toboolean(L, 2);
+    check_concurrency_mode(L, "deploy tasks");
+    push_task(L, [api, full_check]() {
+      return RimeTask::RunMaintenance(api, full_check, &deploy_timer);
+    });
+    return 1;
+  }
+  // api:deploy_async() -> RimeTask
+  static int deploy_async(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    check_concurrency_mode(L, "deploy tasks");
+    push_task(L, [api]() {
+      auto lock = RimeTask::LockDeploy();
+      return api->deploy() ? RimeTask::kSuccess : RimeTask::kFailure;
+    });
+    return 1;
+  }
+  // api:deploy_schema_async(schema_file) -> RimeTask
+  static int deploy_schema_async(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* schema_file = luaL_checkstring(L, 2);
+    check_concurrency_mode(L, "deploy tasks");
+    push_task(L, [api, schema_file = std::string(schema_file)]() {
+      auto lock = RimeTask::LockDeploy();
+      return api->deploy_schema(schema_file.c_str()) ? RimeTask::kSuccess : RimeTask::kFailure;
+    });
+    return 1;
+  }
+  static bool is_schema_file(const std::string& file) {
+    const std::string suffix = ".schema.yaml";
+    return file.size() > suffix.size() &&
+        file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+  // api:deploy_incremental(items [, options]) -> { deployed=, skipped=, failed=, restored= }
+  // items: schema files (*.schema.yaml), config file names, or
+  // { file=, version_key= } (version_key defaults to config_version);
+  // options: { manifest=, threads=, force=, cache=, cache_size= }. Items
+  // whose inputs hash the same as at their last deploy are skipped, see
+  // DeployManifest; with a cache dir, schemas whose compiled dictionaries
+  // came from it are listed as restored, see ArtifactCache
+  static int deploy_incremental(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    const lua_Integer n = (lua_Integer)lua_rawlen(L, 2);
+    // validate first, luaL errors would skip the destructors below
+    for (lua_Integer i = 1; i <= n; ++i) {
+      const int type = lua_rawgeti(L, 2, i);
+      if (type == LUA_TTABLE) {
+        lua_getfield(L, -1, "file");
+        const bool ok = lua_type(L, -1) == LUA_TSTRING;
+        lua_pop(L, 1);
+        if (!ok) return luaL_argerror(L, 2, "item table needs a file string");
+      } else if (type != LUA_TSTRING) {
+        return luaL_argerror(L, 2, "items must be strings or { file=, version_key= }");
+      }
+      lua_pop(L, 1);
+    }
+    const char* manifest = "";
+    const char* cache = "";
+    lua_Integer threads = 0, cache_size = 0;
+    bool force = false;
+    if (lua_istable(L, 3)) {
+      lua_getfield(L, 3, "manifest");
+      manifest = luaL_optstring(L, -1, "");
+      lua_getfield(L, 3, "threads");
+      threads = luaL_optinteger(L, -1, 0);
+      lua_getfield(L, 3, "force");
+      force = lua_toboolean(L, -1);
+      lua_getfield(L, 3, "cache");
+      cache = luaL_optstring(L, -1, "");
+      lua_getfield(L, 3, "cache_size");
+      cache_size = luaL_optinteger(L, -1, 0);
+      lua_pop(L, 5);  // the strings stay referenced by the options table
+    }
+    std::vector<DeployManifest::Item> items((size_t)n);
+    for (lua_Integer i = 1; i <= n; ++i) {
+      DeployManifest::Item& item = items[(size_t)i - 1];
+      if (lua_rawgeti(L, 2, i) == LUA_TTABLE) {
+        lua_getfield(L, -1, "file");
+        item.file = lua_tostring(L, -1);
+        lua_getfield(L, -2, "version_key");
+        item.version_key = lua_isstring(L, -1) ? lua_tostring(L, -1) : "config_version";
+        lua_pop(L, 2);
+      } else {
+        item.file = lua_tostring(L, -1);
+        item.version_key = "config_version";
+      }
+      lua_pop(L, 1);
+      item.is_schema = is_schema_file(item.file);
+    }
+    const std::vector<DeployManifest::Result> results =
+        deploy_incremental(api, items, manifest, (size_t)std::max<lua_Integer>(0, threads), force,
+                           cache, (uintmax_t)std::max<lua_Integer>(0, cache_size));
+    bump_deploy_generation();
+    lua_createtable(L, 0, 4);
+    const char* names[] = {"skipped", "deployed", "failed", "restored"};
+    for (int r = 0; r < 4; ++r) {
+      lua_newtable(L);
+      lua_setfield(L, -2, names[r]);
+    }
+    for (size_t i = 0; i < items.size(); ++i) {
+      lua_getfield(L, -1, names[results[i]]);
+      lua_pushstring(L, items[i].file.c_str());
+      lua_rawseti(L, -2, (lua_Integer)lua_rawlen(L, -2) + 1);
+      lua_pop(L, 1);
+    }
+    return 1;
+  }
+  // api:deploy_inputs(file [, version_key]) -> paths whose change redeploys
+  // the schema file or config file, as tracked by deploy_incremental
+  static int deploy_inputs(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* file = luaL_checkstring(L, 2);
+    const char* version_key = luaL_optstring(L, 3, "config_version");
+    std::vector<std::filesystem::path> inputs;
+    {
+      DeployManifest::Item item{file, version_key, is_schema_file(file)};
+      inputs = ::deploy_inputs(api, item);
+    }
+    lua_createtable(L, (int)inputs.size(), 0);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      lua_pushstring(L, inputs[i].string().c_str());
+      lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    return 1;
+  }
+
+  // RimeWatcher handle: { wait(debounce_ms [, timeout]), fd(), close() },
+  // returned by api:watch
+  static const char kRimeWatcherType[] = "RimeWatcher";
+  static FileWatcher* check_watcher(lua_State *L, int idx) {
+    FileWatcher** w = (FileWatcher**)luaL_checkudata(L, idx, kRimeWatcherType);
+    luaL_argcheck(L, *w != nullptr, idx, "RimeWatcher already closed");
+    return *w;
+  }
+  // watcher:wait(debounce_ms [, timeout]) -> changed paths, overflow | nil, 'timeout'
+  static int watcher_wait(lua_State *L) {
+    FileWatcher* w = check_watcher(L, 1);
+    const lua_Integer debounce_ms = luaL_optinteger(L, 2, 100);
+    const lua_Number timeout = luaL_optnumber(L, 3, -1);
+    bool overflow = false;
+    std::vector<std::string> changed = w->Wait((int)debounce_ms, timeout, &overflow);
+    if (changed.empty() && !overflow) {
+      lua_pushnil(L);
+      lua_pushliteral(L, "timeout");
+      return 2;
+    }
+    lua_createtable(L, (int)changed.size(), 0);
+    for (size_t i = 0; i < changed.size(); ++i) {
+      lua_pushstring(L, changed[i].c_str());
+      lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    lua_pushboolean(L, overflow);
+    return 2;
+  }
+  // integer | nil, readable while events are pending
+  static int watcher_fd(lua_State *L) {
+    const int fd = check_watcher(L, 1)->fd();
+    PUSH_VALUE_OR_NIL(L, (lua_Integer)fd, fd >= 0, lua_pushinteger);
+    return 1;
+  }
+  static int watcher_close(lua_State *L) {
+    FileWatcher** w = (FileWatcher**)luaL_checkudata(L, 1, kRimeWatcherType);
+    delete *w;
+    *w = nullptr;
     return 0;
   }
+  // api:watch(dirs) -> RimeWatcher | nil, error; files written, moved or
+  // deleted in dirs (not recursive), inotify on Linux only
+  static int watch(lua_State *L) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    const lua_Integer n = (lua_Integer)lua_rawlen(L, 2);
+    for (lua_Integer i = 1; i <= n; ++i) {
+      if (lua_rawgeti(L, 2, i) != LUA_TSTRING)
+        return luaL_argerror(L, 2, "dirs must be strings");
+      lua_pop(L, 1);
+    }
+    FileWatcher* watcher;
+    {
+      std::vector<std::string> dirs;
+      for (lua_Integer i = 1; i <= n; ++i) {
+        lua_rawgeti(L, 2, i);
+        dirs.push_back(lua_tostring(L, -1));
+        lua_pop(L, 1);
+      }
+      watcher = new FileWatcher(dirs);
+    }
+    if (!watcher->ok()) {
+      delete watcher;
+      lua_pushnil(L);
+      lua_pushliteral(L, "no directory could be watched");
+      return 2;
+    }
+    FileWatcher** w = (FileWatcher**)lua_newuserdata(L, sizeof(FileWatcher*));
+    *w = watcher;
+    if (luaL_newmetatable(L, kRimeWatcherType)) {
+      static const luaL_Reg watcher_methods[] = {
+        {"wait", watcher_wait},
+        {"fd", watcher_fd},
+        {"close", watcher_close},
+        {nullptr, nullptr}
+      };
+      luaL_newlib(L, watcher_methods);
+      lua_setfield(L, -2, "__index");
+      lua_pushcfunction(L, watcher_close);
+      lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+  }
+  // api:get_resource_usage() -> { rss=, max_rss=, minor_faults=, major_faults= }
+  // of this process, to diff around a call. See ResourceUsage
+  static int get_resource_usage(lua_State *L) {
+    const ResourceUsage usage = resource_usage();
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (lua_Integer)usage.rss);
+    lua_setfield(L, -2, "rss");
+    lua_pushinteger(L, (lua_Integer)usage.max_rss);
+    lua_setfield(L, -2, "max_rss");
+    lua_pushinteger(L, (lua_Integer)usage.minor_faults);
+    lua_setfield(L, -2, "minor_faults");
+    lua_pushinteger(L, (lua_Integer)usage.major_faults);
+    lua_setfield(L, -2, "major_faults");
+    return 1;
+  }
+  // api:use_memory_dirs(traits [, seed_dir]) -> root | nil, error
+  // points the user data, staging and log dirs of traits to a fresh dir on
+  // tmpfs, seeded with a copy of seed_dir; call before setup. See MemoryDirs
+  static int use_memory_dirs(lua_State *L) {
+    smart_shared_ptr_todata<RimeTraits>(L, 2);
+    const char* seed = luaL_optstring(L, 3, "");
+    bool ok;
+    {
+      MemoryDirs::Dirs dirs;
+      std::string error;
+      ok = MemoryDirs::Shared().Create(seed, &dirs, &error);
+      if (ok) {
+        lua_pushstring(L, dirs.root.c_str());
+        lua_pushstring(L, dirs.user_data_dir.c_str());
+        lua_pushstring(L, dirs.staging_dir.c_str());
+        lua_pushstring(L, dirs.log_dir.c_str());
+      } else {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+      }
+    }
+    if (!ok) return 2;
+    lua_setfield(L, 2, "log_dir");
+    lua_setfield(L, 2, "staging_dir");
+    lua_setfield(L, 2, "user_data_dir");
+    return 1;
+  }
+  // api:clone_user_data_dir(template_dir, dest_dir [, link_artifacts])
+  //   -> { files=, cloned=, linked=, copied=, bytes_copied=, seconds= } | nil, error
+  // a private copy of a deployed user data dir for a worker to hand to
+  // RimeTraits, reflinked where possible. See clone_dir
+  static int clone_user_data_dir(lua_State *L) {
+    const char* src = luaL_checkstring(L, 2);
+    const char* dest = luaL_checkstring(L, 3);
+    const bool link_artifacts = lua_isnoneornil(L, 4) || lua_toboolean(L, 4);
+    CloneStats stats;
+    bool ok;
+    {
+      std::string error;
+      ok = clone_dir(src, dest, link_artifacts, &stats, &error);
+      if (!ok) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+      }
+    }
+    if (!ok) return 2;
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, (lua_Integer)stats.files);
+    lua_setfield(L, -2, "files");
+    lua_pushinteger(L, (lua_Integer)stats.cloned);
+    lua_setfield(L, -2, "cloned");
+    lua_pushinteger(L, (lua_Integer)stats.linked);
+    lua_setfield(L, -2, "linked");
+    lua_pushinteger(L, (lua_Integer)stats.copied);
+    lua_setfield(L, -2, "copied");
+    lua_pushinteger(L, (lua_Integer)stats.bytes_copied);
+    lua_setfield(L, -2, "bytes_copied");
+    lua_pushnumber(L, stats.seconds);
+    lua_setfield(L, -2, "seconds");
+    return 1;
+  }
+  // api:release_memory_dirs() -> number of dirs removed; call after finalize
+  static int release_memory_dirs(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)MemoryDirs::Shared().Release());
+    return 1;
+  }
+  // api:prefetch(schema_id [, lock]) -> RimeTask whose result is the bytes
+  // prefetched; pulls the compiled dictionaries of the deployed schema into
+  // the page cache on a worker, mlock'ed too with lock. See Prefetcher
+  static int prefetch(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* schema_id = luaL_checkstring(L, 2);
+    const bool lock = lua_toboolean(L, 3);
+    push_pool_job(L, TaskHandle::kInteger, [api, id = std::string(schema_id), lock]() -> int64_t {
+      return (int64_t)prefetch_schema(api, id, lock);
+    });
+    return 1;
+  }
+  // api:get_prefetch_stats() -> { files=, bytes=, locked=, seconds= } of the
+  // last finished prefetch; locked counts every file still locked
+  static int get_prefetch_stats(lua_State *L) {
+    const Prefetcher::Stats stats = Prefetcher::Shared().last();
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, (lua_Integer)stats.files);
+    lua_setfield(L, -2, "files");
+    lua_pushinteger(L, (lua_Integer)stats.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, (lua_Integer)stats.locked);
+    lua_setfield(L, -2, "locked");
+    lua_pushnumber(L, (lua_Number)stats.seconds);
+    lua_setfield(L, -2, "seconds");
+    return 1;
+  }
+  static void push_cache_residency(lua_State *L, const CacheResidency& residency) {
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, (lua_Integer)residency.files);
+    lua_setfield(L, -2, "files");
+    lua_pushinteger(L, (lua_Integer)residency.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, (lua_Integer)residency.resident);
+    lua_setfield(L, -2, "resident");
+  }
+  // api:get_page_cache_residency(schema_id) -> { files=, bytes=, resident= }
+  // how much of the schema's compiled dictionaries is in the page cache
+  static int get_page_cache_residency(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* schema_id = luaL_checkstring(L, 2);
+    push_cache_residency(L, page_cache_residency(schema_artifacts(api, schema_id)));
+    return 1;
+  }
+  // api:evict_page_cache(schema_id) -> { files=, bytes=, resident= } left
+  // drops the schema's compiled dictionaries from the page cache; call it
+  // between finalize and initialize, mapped pages stay
+  static int evict_page_cache(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* schema_id = luaL_checkstring(L, 2);
+    push_cache_residency(L, ::evict_page_cache(schema_artifacts(api, schema_id)));
+    return 1;
+  }
+  // api:prefetch_unlock() -> bytes unlocked
+  static int prefetch_unlock(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)Prefetcher::Shared().Unlock());
+    return 1;
+  }
+  // api:warm_up(schema_id [, inputs | count])
+  //   -> { { input=, seconds=, candidates=, committed= }, ... }
+  // types each input (its speller/alphabet characters) into a hidden session
+  // and clears it; without a list, the count (50) most common first
+  // syllables of the schema's dictionary. See ::warm_up
+  static int warm_up(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* schema_id = luaL_checkstring(L, 2);
+    lua_Integer count = 50;
+    if (lua_istable(L, 3)) {
+      const lua_Integer n = (lua_Integer)lua_rawlen(L, 3);
+      for (lua_Integer i = 1; i <= n; ++i) {
+        if (lua_rawgeti(L, 3, i) != LUA_TSTRING)
+          return luaL_argerror(L, 3, "inputs must be strings");
+        lua_pop(L, 1);
+      }
+    } else {
+      count = luaL_optinteger(L, 3, 50);
+    }
+    std::vector<WarmUpSample> samples;
+    {
+      std::vector<std::string> inputs;
+      if (lua_istable(L, 3)) {
+        const lua_Integer n = (lua_Integer)lua_rawlen(L, 3);
+        for (lua_Integer i = 1; i <= n; ++i) {
+          lua_rawgeti(L, 3, i);
+          inputs.push_back(lua_tostring(L, -1));
+          lua_pop(L, 1);
+        }
+      } else {
+        inputs = warm_up_inputs(api, schema_id, (size_t)std::max<lua_Integer>(0, count));
+      }
+      samples = ::warm_up(api, schema_id, inputs);
+    }
+    lua_createtable(L, (int)samples.size(), 0);
+    for (size_t i = 0; i < samples.size(); ++i) {
+      lua_createtable(L, 0, 4);
+      lua_pushstring(L, samples[i].input.c_str());
+      lua_setfield(L, -2, "input");
+      lua_pushnumber(L, (lua_Number)samples[i].seconds);
+      lua_setfield(L, -2, "seconds");
+      lua_pushinteger(L, samples[i].candidates);
+      lua_setfield(L, -2, "candidates");
+      lua_pushboolean(L, samples[i].committed);
+      lua_setfield(L, -2, "committed");
+      lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    return 1;
+  }
+  // api:deploy_config_file_async(file_name, version_key) -> RimeTask
+  static int deploy_config_file_async(lua_State *L) {
+    T* api = smart_shared_ptr_todata<T>(L);
+    const char* file = luaL_checkstring(L, 2);
+    const char* key = luaL_checkstring(L, 3);
+    check_concurrency_mode(L, "deploy tasks");
+    push_task(L, [api, file_name = std::string(file), version_key = std::string(key)]() {
+      auto lock = RimeTask::LockDeploy();
+      return api->deploy_config_file(file_name.c_str(), version_key.c_str())
+          ? RimeTask::kSuccess : RimeTask::kFailure;
+    });
+    return 1;
+  }
 
   // Generic template for calling function pointers in RimeApi struct
   template<auto member_ptr, const char* func_name = nullptr>
@@ -1192,10 +2154,13 @@ namespace RimeApiReg {
       luaL_error(L, "RimeApi is not initialized");
       return 0;
     }
-    auto func_ptr = api->*member_ptr;
     assert(func_name);
     // Deduce function signature from member pointer type
-    using FuncType = decltype(func_ptr);
+    using FuncType = std::decay_t<decltype(api->*member_ptr)>;
+    // holds the SessionLocks for the duration of the librime call only,
+    // a luaL_error raised while converting arguments never leaves one locked
+    const auto func_ptr = serialized<SessionLocks::ScopeOf(
+        func_name, takes_session<FuncType>::value)>(api->*member_ptr);
     // 1st is the return type, rest are argument types
     if constexpr SIGNATURE_CHECK(void) {
       func_ptr();
@@ -1259,11 +2224,11 @@ namespace RimeApiReg {
       RimeConfig* config = smart_shared_ptr_todata<RimeConfig>(L, 3);
       Bool result = false;
       if (config) {
-        bool was_borrowed = is_config_borrowed(config);
+        bool was_borrowed = is_borrowed<RimeConfig>(L, 3);
         if (!was_borrowed)
           api->config_close(config);
         result = func_ptr(config_name, config);
-        set_config_borrowed(config, was_borrowed && !result);
+        set_borrowed<RimeConfig>(L, 3, was_borrowed && !result);
       } else {
         result = func_ptr(config_name, config);
       }
@@ -1325,10 +2290,8 @@ namespace RimeApiReg {
       Bool ret = false;
       if (strcmp(func_name, "config_close") == 0) {
         if (config) {
-          if (!is_config_borrowed(config)) {
+          if (!is_borrowed<RimeConfig>(L, 2))
             ret = func_ptr(config);
-            cfg_borrowed_set.erase(config);
-          }
         }
       } else {
         ret = func_ptr(config);
@@ -1403,16 +2366,41 @@ namespace RimeApiReg {
       func_ptr(session_id, prop, value);
       return 0;
     } else if constexpr SIGNATURE_CHECK(Bool, RimeSchemaList*) {
-      // get_schema_list
+      // get_schema_list, the list is only refilled after a deploy or select_schemas
       RimeSchemaList* list = smart_shared_ptr_todata<RimeSchemaList>(L, 2);
-      if (list) RIMEAPI->free_schema_list(list); // ensure no leak
-      Bool result = list ? func_ptr(list) : false;
+      if (!list) {
+        lua_pushboolean(L, false);
+        return 1;
+      }
+      const uint64_t generation = deploy_generation.load(std::memory_order_relaxed);
+      if (list->list && RimeSchemaListReg::is_cache_fresh(L, 2, generation)) {
+        lua_pushboolean(L, true);
+        return 1;
+      }
+      const bool borrowed = is_borrowed<RimeSchemaList>(L, 2);
+      Bool result = False;
+      bool maintenance = false;
+      {
+        // free, refill and the maintenance check under one global lock; no
+        // Lua call in between, a longjmp would leave it held
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        // ensure no leak, lists filled by levers go back to levers
+        if (borrowed)
+          RIMELEVERSAPI->schema_list_destroy(list);
+        else
+          RIMEAPI->free_schema_list(list);
+        result = (api->*member_ptr)(list);
+        maintenance = api->is_maintenance_mode();
+      }
+      set_borrowed<RimeSchemaList>(L, 2, false);
+      RimeSchemaListReg::reset_cache(L, 2, (result && !maintenance) ? generation : 0);
       lua_pushboolean(L, result);
       return 1;
     } else if constexpr SIGNATURE_CHECK(void, RimeSchemaList*) {
       // free_schema_list
       RimeSchemaList* list = smart_shared_ptr_todata<RimeSchemaList>(L, 2);
       if (list) func_ptr(list);
+      RimeSchemaListReg::reset_cache(L, 2);
       return 0;
     } else if constexpr SIGNATURE_CHECK(Bool, RimeSessionId, char*, size_t) {
       // get_current_schema(session_id, buffer, buffer_size)
@@ -1638,22 +2626,46 @@ namespace RimeApiReg {
   static const luaL_Reg methods[] = {
     // Basic API functions
     {"setup", WRAP_API_FUNC(setup)},
-    {"initialize", WRAP_API_FUNC(initialize)},
+    {"initialize", WRAP_DEPLOY_FUNC(initialize)},
     {"finalize", WRAP_API_FUNC(finalize)},
     {"set_notification_handler", lua_set_notification_handler},
     {"drain_notifications", drain_notifications},
+    {"get_notification_stats", get_notification_stats},
+    {"get_notification_fd", get_notification_fd},
+    {"get_deploy_timings", get_deploy_timings},
+    {"get_steady_time", get_steady_time},
+    {"set_concurrency_mode", set_concurrency_mode},
+    {"get_concurrency_mode", get_concurrency_mode},
 
     // Maintenance
-    {"start_maintenance", WRAP_API_FUNC(start_maintenance)},
+    {"start_maintenance", WRAP_DEPLOY_FUNC(start_maintenance)},
     {"is_maintenance_mode", WRAP_API_FUNC(is_maintenance_mode)},
-    {"join_maintenance_thread", WRAP_API_FUNC(join_maintenance_thread)},
+    {"join_maintenance_thread", WRAP_DEPLOY_FUNC(join_maintenance_thread)},
 
     // Deployment
     {"deployer_initialize", WRAP_API_FUNC(deployer_initialize)},
-    {"prebuild", WRAP_API_FUNC(prebuild)},
-    {"deploy", WRAP_API_FUNC(deploy)},
-    {"deploy_schema", WRAP_API_FUNC(deploy_schema)},
-    {"deploy_config_file", WRAP_API_FUNC(deploy_config_file)},
+    {"prebuild", WRAP_DEPLOY_FUNC(prebuild)},
+    {"deploy", WRAP_DEPLOY_FUNC(deploy)},
+    {"deploy_schema", WRAP_DEPLOY_FUNC(deploy_schema)},
+    {"deploy_config_file", WRAP_DEPLOY_FUNC(deploy_config_file)},
+    {"start_maintenance_async", start_maintenance_async},
+    {"deploy_async", deploy_async},
+    {"deploy_schema_async", deploy_schema_async},
+    {"deploy_config_file_async", deploy_config_file_async},
+    {"deploy_incremental", deploy_incremental},
+    {"deploy_inputs", deploy_inputs},
+    {"watch", watch},
+    {"prefetch", prefetch},
+    {"get_prefetch_stats", get_prefetch_stats},
+    {"prefetch_unlock", prefetch_unlock},
+    {"get_page_cache_residency", get_page_cache_residency},
+    {"evict_page_cache", evict_page_cache},
+    {"get_resource_usage", get_resource_usage},
+    {"use_memory_dirs", use_memory_dirs},
+    {"release_memory_dirs", release_memory_dirs},
+    {"clone_user_data_dir", clone_user_data_dir},
+    {"warm_up", warm_up},
+    {"async", async_call},
     {"sync_user_data", WRAP_API_FUNC(sync_user_data)},
 
     // Session management
@@ -1907,33 +2919,25 @@ namespace RimeLeversApiReg {
       return static_cast<RimeCustomSettings*>(lua_touserdata(L, idx));
     return nullptr;
   }
-  static inline void mark_levers_settings_destroyed(void* ptr) {
-    if (!ptr) return;
-    std::lock_guard<std::mutex> lk(levers_settings_mutex);
-    levers_settings_owned.erase(ptr);
-  }
-  // Generic helper: wrap a levers-owned raw pointer into a shared_ptr with
-  // a deleter that calls destroy_levers_settings, then push to Lua.
+  // Generic helper: wrap a levers-owned raw pointer into a shared_ptr whose
+  // deleter destroys the settings, then push to Lua. The userdata is the only
+  // owner, so custom_settings_destroy just resets it.
   template<typename U>
   static void push_from_raw(lua_State* L, U* ptr) {
     if (!ptr) { lua_pushnil(L); return; }
-    std::lock_guard<std::mutex> lk(levers_settings_mutex);
-    levers_settings_owned.insert(ptr);
-    const auto destroy_levers_settings = [](void* ptr) {
-      if (!ptr) return;
-      bool should_destroy = false;
-      std::lock_guard<std::mutex> lk(levers_settings_mutex);
-      auto it = levers_settings_owned.find(ptr);
-      if (it != levers_settings_owned.end()) {
-        levers_settings_owned.erase(it);
-        should_destroy = true;
-      }
-      if (should_destroy)
-        if (auto api = RIMELEVERSAPI) api->custom_settings_destroy(reinterpret_cast<RimeCustomSettings*>(ptr));
-    };
-    auto sptr = std::shared_ptr<U>(ptr, [&](U* p) { destroy_levers_settings(reinterpret_cast<void*>(p)); });
+    auto sptr = std::shared_ptr<U>(ptr, [](U* p) {
+      if (auto api = RIMELEVERSAPI) api->custom_settings_destroy(reinterpret_cast<RimeCustomSettings*>(p));
+    });
     LuaType<std::shared_ptr<U>>::pushdata(L, sptr);
   }
+  // reset the shared_ptr userdata at idx, true if it was one of U
+  template<typename U>
+  static bool reset_owned(lua_State* L, int idx) {
+    auto* h = LuaType<std::shared_ptr<U>>::holder(L, idx);
+    if (!h) return false;
+    h->ptr.reset();
+    return true;
+  }
   template<auto member_ptr, const char* func_name = nullptr>
   static int call_function_pointer(lua_State *L) {
     T* api = smart_shared_ptr_todata<T>(L);
@@ -1941,9 +2945,10 @@ namespace RimeLeversApiReg {
       luaL_error(L, "RimeLeversApi is not initialized");
       return 0;
     }
-    auto func_ptr = api->*member_ptr;
     assert(func_name);
-    using FuncType = decltype(func_ptr);
+    using FuncType = std::decay_t<decltype(api->*member_ptr)>;
+    // levers calls all touch deployed files and user dicts
+    const auto func_ptr = serialized<SessionLocks::kGlobal>(api->*member_ptr);
     if constexpr SIGNATURE_CHECK(RimeCustomSettings*, const char*, const char*) {
       const char* param1 = luaL_checkstring(L, 2);
       const char* param2 = luaL_checkstring(L, 3);
@@ -1952,17 +2957,13 @@ namespace RimeLeversApiReg {
       return 1;
     } else if constexpr SIGNATURE_CHECK(void, RimeCustomSettings*) {
       RimeCustomSettings* settings = lua_to_custom_settings(L, 2);
-      func_ptr(settings);
       if (settings && strcmp(func_name, "custom_settings_destroy") == 0) {
-        mark_levers_settings_destroyed(settings);
-        if (luaL_testudata(L, 2, LuaType<std::shared_ptr<RimeCustomSettings>>::type()->name())) {
-          auto &sp = LuaType<std::shared_ptr<RimeCustomSettings>>::todata(L, 2);
-          sp.reset();
-        } else if (luaL_testudata(L, 2, LuaType<std::shared_ptr<RimeSwitcherSettings>>::type()->name())) {
-          auto &sp = LuaType<std::shared_ptr<RimeSwitcherSettings>>::todata(L, 2);
-          sp.reset();
-        }
+        // settings from custom_settings_init/switcher_settings_init are
+        // destroyed by their deleter, exactly once
+        if (reset_owned<RimeCustomSettings>(L, 2) || reset_owned<RimeSwitcherSettings>(L, 2))
+          return 0;
       }
+      func_ptr(settings);
       return 0;
     } else if constexpr SIGNATURE_CHECK(RimeSwitcherSettings*, ) {
       // switcher_settings_init()
@@ -1998,14 +2999,14 @@ namespace RimeLeversApiReg {
       Bool ret = false;
       if (strcmp(func_name, "customize_bool") == 0) {
         Bool val = lua_toboolean(L, 4);
-        ret = reinterpret_cast<Bool(*)(RimeCustomSettings*, const char*, Bool)>(func_ptr)(settings, key, val);
+        ret = func_ptr(settings, key, val);
       } else if (strcmp(func_name, "customize_int") == 0) {
         int val = luaL_checkinteger(L, 4);
-        ret = reinterpret_cast<Bool(*)(RimeCustomSettings*, const char*, int)>(func_ptr)(settings, key, val);
+        ret = func_ptr(settings, key, val);
       } else {
         // fallback: try boolean first
         Bool val = lua_toboolean(L, 4);
-        ret = reinterpret_cast<Bool(*)(RimeCustomSettings*, const char*, Bool)>(func_ptr)(settings, key, val);
+        ret = func_ptr(settings, key, val);
       }
       lua_pushboolean(L, ret);
       return 1;
@@ -2030,7 +3031,7 @@ namespace RimeLeversApiReg {
       RimeCustomSettings* settings = lua_to_custom_settings(L, 2);
       RimeConfig* cfg = smart_shared_ptr_todata<RimeConfig>(L, 3);
       Bool ret = func_ptr(settings, cfg);
-      if (ret) set_config_borrowed(cfg, true);
+      if (ret) set_borrowed<RimeConfig>(L, 3, true);
       lua_pushboolean(L, ret);
       return 1;
     } else if constexpr SIGNATURE_CHECK(Bool, RimeSwitcherSettings*, RimeSchemaList*) {
@@ -2039,13 +3040,15 @@ namespace RimeLeversApiReg {
       RimeSchemaList* list = smart_shared_ptr_todata<RimeSchemaList>(L, 3);
       Bool ret = func_ptr(settings, list);
       if (ret)
-        schemalist_borrowed_set.insert(list);
+        set_borrowed<RimeSchemaList>(L, 3, true);
+      RimeSchemaListReg::reset_cache(L, 3);
       lua_pushboolean(L, ret);
       return 1;
     } else if constexpr SIGNATURE_CHECK(void, RimeSchemaList*) {
       // schema_list_destroy
       RimeSchemaList* list = smart_shared_ptr_todata<RimeSchemaList>(L, 2);
       func_ptr(list);
+      RimeSchemaListReg::reset_cache(L, 2);
       return 0;
     } else if constexpr SIGNATURE_CHECK(const char*, RimeSchemaInfo*) {
       // get_schema_* (id/name/version/author/description/file_path)
@@ -2122,6 +3125,301 @@ namespace RimeLeversApiReg {
       return 0;
     }
   }
+  // schema catalog: every RimeSchemaInfo field read once in C++, kept until
+  // deploy_generation moves on
+  struct SchemaRecord {
+    string schema_id, name, version, author, description, file_path;
+  };
+  static std::mutex catalog_mutex;
+  static uint64_t catalog_generation = 0;
+  static vector<SchemaRecord> catalog;
+  static string to_string_or_empty(const char* s) { return s ? string(s) : string(); }
+  static bool load_schema_catalog(T* levers, vector<SchemaRecord>* records) {
+    RimeSwitcherSettings* settings = levers->switcher_settings_init();
+    if (!settings) return false;
+    RimeCustomSettings* custom = reinterpret_cast<RimeCustomSettings*>(settings);
+    levers->load_settings(custom);
+    RimeSchemaList list = {0, nullptr};
+    bool ok = levers->get_available_schema_list(settings, &list);
+    if (ok) {
+      records->reserve(list.size);
+      for (size_t i = 0; i < list.size; ++i) {
+        const RimeSchemaListItem& item = list.list[i];
+        RimeSchemaInfo* info = reinterpret_cast<RimeSchemaInfo*>(item.reserved);
+        SchemaRecord r;
+        r.schema_id = to_string_or_empty(item.schema_id);
+        r.name = to_string_or_empty(item.name);
+        if (info) {
+          r.version = to_string_or_empty(levers->get_schema_version(info));
+          r.author = to_string_or_empty(levers->get_schema_author(info));
+          r.description = to_string_or_empty(levers->get_schema_description(info));
+          r.file_path = to_string_or_empty(levers->get_schema_file_path(info));
+        }
+        records->push_back(std::move(r));
+      }
+      levers->schema_list_destroy(&list);
+    }
+    levers->custom_settings_destroy(custom);
+    return ok;
+  }
+  static void push_schema_record(lua_State* L, const SchemaRecord& r) {
+    lua_createtable(L, 0, 6);
+#define SET_RECORD_FIELD(field) \
+    if (!r.field.empty()) { lua_pushlstring(L, r.field.data(), r.field.size()); lua_setfield(L, -2, #field); }
+    SET_RECORD_FIELD(schema_id)
+    SET_RECORD_FIELD(name)
+    SET_RECORD_FIELD(version)
+    SET_RECORD_FIELD(author)
+    SET_RECORD_FIELD(description)
+    SET_RECORD_FIELD(file_path)
+#undef SET_RECORD_FIELD
+  }
+  // get_schema_catalog(): array of plain tables of available schemas
+  static int get_schema_catalog(lua_State* L) {
+    T* levers = smart_shared_ptr_todata<T>(L);
+    if (!levers) {
+      lua_pushnil(L);
+      return 1;
+    }
+    std::lock_guard<std::mutex> lk(catalog_mutex);
+    const uint64_t generation = deploy_generation.load(std::memory_order_relaxed);
+    if (catalog_generation != generation) {
+      vector<SchemaRecord> records;
+      bool loaded = false, maintenance = false;
+      {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        loaded = load_schema_catalog(levers, &records);
+        maintenance = RIMEAPI->is_maintenance_mode();
+      }
+      if (!loaded) {
+        lua_pushnil(L);
+        return 1;
+      }
+      catalog.swap(records);
+      // results read while maintenance is running are not kept
+      catalog_generation = maintenance ? 0 : generation;
+    }
+    lua_createtable(L, (int)catalog.size(), 0);
+    for (size_t i = 0; i < catalog.size(); ++i) {
+      push_schema_record(L, catalog[i]);
+      lua_rawseti(L, -2, (lua_Integer)(i + 1));
+    }
+    return 1;
+  }
+  // customize_batch: entries are collected and validated before anything is
+  // applied, list values are built into standalone RimeConfig items
+  struct CustomizeEntry {
+    string key;
+    int type = LUA_TNIL;
+    bool is_int = false;
+    Bool b = False;
+    int i = 0;
+    double d = 0;
+    string s;
+    RimeConfig* item = nullptr;
+    std::shared_ptr<RimeConfig> owned;
+  };
+  static const int kMaxBatchDepth = 32;
+  static bool is_lua_sequence(lua_State* L, int idx) {
+    size_t len = lua_rawlen(L, idx);
+    if (len == 0) return false;
+    size_t count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      lua_pop(L, 1);
+      ++count;
+    }
+    return count == len;
+  }
+  static RimeConfig* lua_to_config(lua_State* L, int idx) {
+    if (!luaL_testudata(L, idx, LuaType<std::shared_ptr<RimeConfig>>::type()->name()))
+      return nullptr;
+    return smart_shared_ptr_todata<RimeConfig>(L, idx);
+  }
+  // write the lua value at idx into cfg at path, recursing into tables
+  static bool fill_config(lua_State* L, int idx, RimeConfig* cfg, const string& path, int depth, string* error) {
+    RimeApi* api = RIMEAPI;
+    idx = lua_absindex(L, idx);
+    switch (lua_type(L, idx)) {
+      case LUA_TBOOLEAN:
+        return api->config_set_bool(cfg, path.c_str(), lua_toboolean(L, idx));
+      case LUA_TNUMBER:
+        if (lua_isinteger(L, idx))
+          return api->config_set_int(cfg, path.c_str(), (int)lua_tointeger(L, idx));
+        return api->config_set_double(cfg, path.c_str(), lua_tonumber(L, idx));
+      case LUA_TSTRING:
+        return api->config_set_string(cfg, path.c_str(), lua_tostring(L, idx));
+      case LUA_TUSERDATA:
+        if (RimeConfig* value = lua_to_config(L, idx))
+          return api->config_set_item(cfg, path.c_str(), value);
+        break;
+      case LUA_TTABLE: {
+        if (depth > kMaxBatchDepth) {
+          *error = "table nested too deep at " + path;
+          return false;
+        }
+        if (is_lua_sequence(L, idx)) {
+          if (!api->config_create_list(cfg, path.c_str())) return false;
+          size_t len = lua_rawlen(L, idx);
+          for (size_t n = 1; n <= len; ++n) {
+            lua_rawgeti(L, idx, n);
+            bool ok = fill_config(L, -1, cfg, path + "/@" + std::to_string(n - 1), depth + 1, error);
+            lua_pop(L, 1);
+            if (!ok) return false;
+          }
+          return true;
+        }
+        if (!api->config_create_map(cfg, path.c_str())) return false;
+        lua_pushnil(L);
+        while (lua_next(L, idx)) {
+          if (lua_type(L, -2) != LUA_TSTRING) {
+            lua_pop(L, 2);
+            *error = "non-string key in map at " + path;
+            return false;
+          }
+          bool ok = fill_config(L, -1, cfg, path + "/" + lua_tostring(L, -2), depth + 1, error);
+          lua_pop(L, 1);
+          if (!ok) { lua_pop(L, 1); return false; }
+        }
+        return true;
+      }
+      default:
+        break;
+    }
+    *error = string("unsupported value type ") + luaL_typename(L, idx) + " at " + path;
+    return false;
+  }
+  static bool collect_customize_entries(lua_State* L, int idx, const string& prefix, int depth,
+                                        vector<CustomizeEntry>* entries, string* error) {
+    idx = lua_absindex(L, idx);
+    if (depth > kMaxBatchDepth) {
+      *error = "table nested too deep at " + prefix;
+      return false;
+    }
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      if (lua_type(L, -2) != LUA_TSTRING) {
+        lua_pop(L, 2);
+        *error = "customize_batch expects string keys" + (prefix.empty() ? string() : " at " + prefix);
+        return false;
+      }
+      CustomizeEntry entry;
+      entry.key = prefix.empty() ? string(lua_tostring(L, -2)) : prefix + "/" + lua_tostring(L, -2);
+      entry.type = lua_type(L, -1);
+      bool ok = true;
+      switch (entry.type) {
+        case LUA_TBOOLEAN:
+          entry.b = lua_toboolean(L, -1);
+          break;
+        case LUA_TNUMBER:
+          if (lua_isinteger(L, -1)) {
+            lua_Integer v = lua_tointeger(L, -1);
+            if (v < INT_MIN || v > INT_MAX) {
+              *error = "integer out of range at " + entry.key;
+              ok = false;
+            }
+            entry.i = (int)v;
+            entry.is_int = true;
+          } else {
+            entry.d = lua_tonumber(L, -1);
+          }
+          break;
+        case LUA_TSTRING:
+          entry.s = lua_tostring(L, -1);
+          break;
+        case LUA_TUSERDATA:
+          entry.item = lua_to_config(L, -1);
+          if (!entry.item) {
+            *error = "unsupported userdata at " + entry.key;
+            ok = false;
+          }
+          break;
+        case LUA_TTABLE:
+          if (!is_lua_sequence(L, -1)) {
+            // nested map: flatten into slash separated paths
+            ok = collect_customize_entries(L, -1, entry.key, depth + 1, entries, error);
+            lua_pop(L, 1);
+            if (!ok) { lua_pop(L, 1); return false; }
+            continue;
+          } else {
+            RimeApi* api = RIMEAPI;
+            auto tmp = std::shared_ptr<RimeConfig>(new RimeConfig{nullptr},
+                [api](RimeConfig* c) { api->config_close(c); delete c; });
+            entry.owned = std::shared_ptr<RimeConfig>(new RimeConfig{nullptr},
+                [api](RimeConfig* c) { api->config_close(c); delete c; });
+            ok = api->config_init(tmp.get()) &&
+                 fill_config(L, -1, tmp.get(), "value", depth + 1, error) &&
+                 api->config_get_item(tmp.get(), "value", entry.owned.get());
+            if (!ok && error->empty())
+              *error = "failed to build list at " + entry.key;
+            entry.item = entry.owned.get();
+          }
+          break;
+        default:
+          *error = string("unsupported value type ") + luaL_typename(L, -1) + " at " + entry.key;
+          ok = false;
+          break;
+      }
+      lua_pop(L, 1);
+      if (!ok) { lua_pop(L, 1); return false; }
+      entries->push_back(std::move(entry));
+    }
+    return true;
+  }
+  // customize_batch(settings, tbl): apply all entries, then save once; an
+  // empty table is a no-op. Returns false and a message when the table is
+  // rejected (nothing applied) or an entry fails.
+  // A failed entry discards every unsaved edit of settings, not only this
+  // batch: the levers API cannot take a patch key back nor copy settings to
+  // stage on, so settings are reloaded from disk. Save earlier customize_*
+  // calls before a batch that may fail
+  static int customize_batch(lua_State* L) {
+    T* levers = smart_shared_ptr_todata<T>(L);
+    RimeCustomSettings* settings = lua_to_custom_settings(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    if (!levers || !settings) {
+      lua_pushboolean(L, false);
+      return 1;
+    }
+    string error;
+    bool ok = true;
+    {
+      vector<CustomizeEntry> entries;
+      ok = collect_customize_entries(L, 3, string(), 0, &entries, &error);
+      // the levers calls and the save as one step, no Lua call until the
+      // guard is gone
+      auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+      for (size_t n = 0; ok && n < entries.size(); ++n) {
+        const CustomizeEntry& e = entries[n];
+        const char* key = e.key.c_str();
+        switch (e.type) {
+          case LUA_TBOOLEAN: ok = levers->customize_bool(settings, key, e.b); break;
+          case LUA_TNUMBER:
+            ok = e.is_int ? levers->customize_int(settings, key, e.i)
+                          : levers->customize_double(settings, key, e.d);
+            break;
+          case LUA_TSTRING: ok = levers->customize_string(settings, key, e.s.c_str()); break;
+          default: ok = levers->customize_item(settings, key, e.item); break;
+        }
+        if (!ok) {
+          error = "failed to customize " + e.key + ", unsaved settings reloaded from disk";
+          // drop the partially applied patch, see above
+          levers->load_settings(settings);
+        }
+      }
+      if (error.empty() && levers->settings_is_modified(settings)) {
+        ok = levers->save_settings(settings);
+        bump_deploy_generation();
+      }
+    }
+    if (!error.empty()) {
+      lua_pushboolean(L, false);
+      lua_pushstring(L, error.c_str());
+      return 2;
+    }
+    lua_pushboolean(L, ok);
+    return 1;
+  }
   static int to_rime_levers_api(lua_State *L) {
     RimeCustomApi* t = smart_shared_ptr_todata<RimeCustomApi>(L);
     if (!t) {
@@ -2158,7 +3456,7 @@ namespace RimeLeversApiReg {
     {"custom_settings_init", WRAP_API_FUNC(custom_settings_init)},
     {"custom_settings_destroy", WRAP_API_FUNC(custom_settings_destroy)},
     {"load_settings", WRAP_API_FUNC(load_settings)},
-    {"save_settings", WRAP_API_FUNC(save_settings)},
+    {"save_settings", WRAP_DEPLOY_FUNC(save_settings)},
     {"customize_bool", WRAP_API_FUNC(customize_bool)},
     {"customize_int", WRAP_API_FUNC(customize_int)},
     {"customize_double", WRAP_API_FUNC(customize_double)},
@@ -2176,7 +3474,7 @@ namespace RimeLeversApiReg {
     {"get_schema_author", WRAP_API_FUNC(get_schema_author)},
     {"get_schema_description", WRAP_API_FUNC(get_schema_description)},
     {"get_schema_file_path", WRAP_API_FUNC(get_schema_file_path)},
-    {"select_schemas", WRAP_API_FUNC(select_schemas)},
+    {"select_schemas", WRAP_DEPLOY_FUNC(select_schemas)},
     {"get_hotkeys", WRAP_API_FUNC(get_hotkeys)},
     {"set_hotkeys", WRAP_API_FUNC(set_hotkeys)},
     {"user_dict_iterator_init", WRAP_API_FUNC(user_dict_iterator_init)},
@@ -2187,6 +3485,8 @@ namespace RimeLeversApiReg {
     {"export_user_dict", WRAP_API_FUNC(export_user_dict)},
     {"import_user_dict", WRAP_API_FUNC(import_user_dict)},
     {"customize_item", WRAP_API_FUNC(customize_item)},
+    {"customize_batch", customize_batch},
+    {"get_schema_catalog", get_schema_catalog},
     {nullptr, nullptr}
   };
   static const luaL_Reg vars_get[] = {
@@ -2196,6 +3496,7 @@ namespace RimeLeversApiReg {
 }
 #undef SIGNATURE_CHECK
 #undef WRAP_API_FUNC
+#undef WRAP_DEPLOY_FUNC
 #undef DECLARE_FUNC_NAME_VAR
 
 static int os_trymkdir(lua_State* L) {
@@ -2230,24 +3531,6 @@ static int os_trymkdir(lua_State* L) {
   return 1;
 }
 
-static const fs::path get_path_from_lua(lua_State* L, int index) {
-  const char* path = luaL_checkstring(L, index);
-  if (!path)
-    return fs::path();
-#ifdef _WIN32
-  unsigned int cp = (lua_gettop(L) > 1) ? (unsigned int)luaL_checkinteger(L, 2) : CP_UTF8;
-  int len = MultiByteToWideChar(cp, 0, path, -1, nullptr, 0);
-  if (len <= 0)
-    return fs::path();
-  std::wstring wpath(len, L'\0');
-  if(MultiByteToWideChar(cp, 0, path, -1, &wpath[0], len) == 0)
-    return fs::path();
-  return fs::path(wpath);
-#else
-  return fs::path(path);
-#endif
-}
-
 static int file_exists(lua_State* L) {
   fs::path p = get_path_from_lua(L, 1);
   bool ret = fs::exists(p);
@@ -2294,7 +3577,9 @@ static int resolve_path(lua_State* L) {
 }
 
 static int readline(lua_State* L) {
-  static LineEditor editor(4096);
+  ModuleContext* ctx = get_module_context(L);
+  if (!ctx->editor) ctx->editor = std::make_unique<LineEditor>(4096);
+  LineEditor& editor = *ctx->editor;
   const char* prompt = luaL_optstring(L, 1, nullptr);
   
   if (lua_istable(L, 2)) {
@@ -2373,25 +3658,34 @@ static void register_rime_bindings(lua_State *L) {
 #undef REGISTER_GLOBAL_FUNC
 }
 
-static void ensure_librime_gc(lua_State* L) {
-  lua_getfield(L, LUA_REGISTRYINDEX, "__rime_library_gc");
-  if (!lua_isnil(L, -1)) {
-    lua_pop(L, 1);
-    return;
-  }
-  lua_pop(L, 1);
-  void* ud = lua_newuserdata(L, 0);
-  if (!ud) return;
-  if (luaL_newmetatable(L, "__rime_library_gc_mt")) {
+// created before any other module object, so lua_close finalizes it last
+static bool ensure_module_context(lua_State* L) {
+  if (ModuleContext* ctx = get_module_context(L))
+    return ctx->holds_rime_api;
+  void* ud = lua_newuserdata(L, sizeof(ModuleContext));
+  ModuleContext* ctx = new (ud) ModuleContext();
+  if (luaL_newmetatable(L, "__rime_module_context_mt")) {
     lua_pushcfunction(L, [](lua_State* L) -> int {
-        rime_api = nullptr;
-        FREE_RIME();
+        ModuleContext* ctx = (ModuleContext*)lua_touserdata(L, 1);
+        // no librime thread writes to the sink once unsubscribed
+        RimeApiReg::noti_router.Unsubscribe(&ctx->notifications);
+        RimeApiReg::update_notification_handler();
+        const bool holds_rime_api = ctx->holds_rime_api;
+        ctx->~ModuleContext();
+        // deploy tasks and pool jobs of any lua_State may still call librime
+        if (holds_rime_api)
+          release_rime_api([]() {
+            PendingJobs::Shared().WaitIdle();
+            WorkerPool::Shutdown();
+          });
         return 0;
     });
     lua_setfield(L, -2, "__gc");
   }
   lua_setmetatable(L, -2);
-  lua_setfield(L, LUA_REGISTRYINDEX, "__rime_library_gc");
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &module_context_key);
+  ctx->holds_rime_api = acquire_rime_api();
+  return ctx->holds_rime_api;
 }
 extern "C" RIME_API int luaopen_rimeapi_lua(lua_State *L) {
 // check lua version 5.4
@@ -2405,9 +3699,9 @@ extern "C" RIME_API int luaopen_rimeapi_lua(lua_State *L) {
     luaL_error(L, "rimeapi_lua requires Lua 5.4 or higher");
     return 0;
   }
-  ensure_rime_api();
+  if (!ensure_module_context(L))
+    return luaL_error(L, "rimeapi_lua failed to load librime");
   register_rime_bindings(L);
-  ensure_librime_gc(L);
   // Create and return a module table that references main constructors
   lua_newtable(L);
   const char* names[] = {
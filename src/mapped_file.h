@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file as a NUL-terminated buffer.
+// The OS zero-fills the tail of the last mapped page, so the mapping itself
+// is terminated unless the file size is page aligned; only in that case the
+// bytes are copied to get room for the terminator.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::filesystem::path& path) { Open(path); }
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool ok() const { return ok_; }
+  size_t size() const { return size_; }
+  const char* c_str() const {
+    return data_ ? static_cast<const char*>(data_) : copy_.c_str();
+  }
+
+ private:
+  static size_t PageSize() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+  }
+
+  void Open(const std::filesystem::path& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(file, &fsize)) { CloseHandle(file); return; }
+    size_ = (size_t)fsize.QuadPart;
+    if (size_ > 0) {
+      HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping) {
+        data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { ::close(fd); return; }
+    size_ = (size_t)st.st_size;
+    if (size_ > 0) {
+      void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) data_ = p;
+    }
+    ::close(fd);
+#endif
+    if (size_ > 0 && !data_) return;
+    if (size_ > 0 && size_ % PageSize() == 0) {
+      copy_.assign(static_cast<const char*>(data_), size_);
+      Close();
+    }
+    ok_ = true;
+  }
+
+  void Close() {
+    if (!data_) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(data_, size_);
+#endif
+    data_ = nullptr;
+  }
+
+  void* data_ = nullptr;
+  size_t size_ = 0;
+  bool ok_ = false;
+  std::string copy_;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "dir_clone.h"
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+// Throwaway user data, staging and log dirs for test runs, in a private
+// directory on tmpfs so that userdb syncs and build output never reach a
+// disk: /dev/shm, else $XDG_RUNTIME_DIR, else the system temp dir (not
+// memory backed, macOS and Windows have no tmpfs to default to).
+//
+// Every run gets root/user (seeded with a clone_dir of a prebuilt user
+// data dir if given, its build dir included, copied rather than hardlinked
+// so the seed is not made read-only), root/user/build and root/log.
+// The roots are removed by Release, or at exit. Not on finalize: a run may
+// finalize, customize the user data and initialize again. Roots left behind
+// by a process that crashed are swept by the next Create.
+class MemoryDirs {
+ public:
+  struct Dirs {
+    std::string root;
+    std::string user_data_dir;
+    std::string staging_dir;
+    std::string log_dir;
+  };
+
+  static MemoryDirs& Shared() {
+    static MemoryDirs dirs;
+    return dirs;
+  }
+  ~MemoryDirs() { Release(); }
+
+  static std::filesystem::path Base() {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+#ifndef _WIN32
+    if (fs::is_directory("/dev/shm", ec) && access("/dev/shm", W_OK) == 0) return "/dev/shm";
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime && access(runtime, W_OK) == 0) return runtime;
+#endif
+    const fs::path tmp = fs::temp_directory_path(ec);
+    return ec ? fs::path(".") : tmp;
+  }
+
+  // false with error set when a dir can not be made or the seed copied
+  bool Create(const std::string& seed, Dirs* dirs, std::string* error) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!seed.empty() && !fs::is_directory(seed, ec)) {
+      *error = "seed is not a directory: " + seed;
+      return false;
+    }
+    const fs::path base = Base();
+    SweepStale(base);
+    fs::path root;
+    for (int attempt = 0; attempt < 16; ++attempt) {
+      root = base / ("rimeapi-" + std::to_string(Pid()) + "-" + std::to_string(std::random_device{}()));
+      if (fs::create_directory(root, ec)) break;
+      root.clear();
+      if (ec) break;
+    }
+    if (root.empty()) {
+      *error = "failed to create a dir in " + base.string() + (ec ? ": " + ec.message() : "");
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      roots_.push_back(root);
+    }
+    const fs::path user = root / "user";
+    if (!seed.empty()) {
+      CloneStats stats;
+      std::string clone_error;
+      if (!clone_dir(seed, user, false, &stats, &clone_error)) {
+        *error = "failed to seed from " + seed + ": " + clone_error;
+        return false;
+      }
+    }
+    for (const fs::path& dir : {user / "build", root / "log"}) {
+      fs::create_directories(dir, ec);
+      if (ec) {
+        *error = "failed to create " + dir.string() + ": " + ec.message();
+        return false;
+      }
+    }
+    dirs->root = root.string();
+    dirs->user_data_dir = user.string();
+    dirs->staging_dir = (user / "build").string();
+    dirs->log_dir = (root / "log").string();
+    return true;
+  }
+
+  // removes every root made by Create, returns how many
+  size_t Release() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t removed = 0;
+    for (const auto& root : roots_) {
+      std::error_code ec;
+      if (std::filesystem::remove_all(root, ec) > 0 && !ec) ++removed;
+    }
+    roots_.clear();
+    return removed;
+  }
+
+ private:
+  // removes rimeapi-<pid>-* roots whose process is gone (POSIX only, where
+  // kill(pid, 0) tells); live ones, ours included, are left alone
+  static void SweepStale(const std::filesystem::path& base) {
+#ifndef _WIN32
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const long self = Pid();
+    for (fs::directory_iterator it(base, ec), end; !ec && it != end; it.increment(ec)) {
+      const std::string name = it->path().filename().string();
+      if (name.compare(0, 8, "rimeapi-") != 0) continue;
+      char* rest = nullptr;
+      const long pid = strtol(name.c_str() + 8, &rest, 10);
+      if (pid <= 0 || pid == self || *rest != '-') continue;
+      std::error_code entry_ec;
+      if (!it->is_directory(entry_ec)) continue;
+      if (kill((pid_t)pid, 0) == -1 && errno == ESRCH) fs::remove_all(it->path(), entry_ec);
+    }
+#else
+    (void)base;
+#endif
+  }
+
+  static long Pid() {
+#ifdef _WIN32
+    return 0;
+#else
+    return (long)getpid();
+#endif
+  }
+
+  std::mutex mutex_;
+  std::vector<std::filesystem::path> roots_;
+};
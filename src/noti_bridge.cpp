@@ -1,63 +1,614 @@
 #include "utils.h"
+#include "deploy_manifest.h"
+#include "dir_clone.h"
+#include "file_watcher.h"
 #include "line_editor.h"
+#include "mapped_file.h"
+#include "memory_dirs.h"
+#include "noti_queue.h"
+#include "prefetch.h"
+#include "resource_usage.h"
+#include "rime_task.h"
+#include "warm_up.h"
 
-typedef struct {
-  RimeSessionId id;
-  std::string type;
-  std::string value;
-} RimeNotificationMsg;
-
-static std::vector<RimeNotificationMsg> msg_queue;
-static std::vector<RimeNotificationMsg> lua_queue;
-static std::mutex noti_mutex;
+// written by librime threads, drained on the Lua thread; replaced only
+// while no handler is installed
+static std::unique_ptr<NotificationQueue> msg_queue =
+    std::make_unique<NotificationQueue>();
+// two buffers swapped on every drain: front_queue holds the messages last
+// handed to Lua (their pointers stay valid until the next drain), back_queue
+// the ones already popped for peek but not delivered yet (their pointers
+// only until the next peek or drain, both may move them). Pop swaps string
+// buffers with the slots, so nothing is copied or allocated in steady state.
+static std::vector<NotificationQueue::Message> front_queue;
+static std::vector<NotificationQueue::Message> back_queue;
+static size_t back_count = 0;
+static std::vector<NotificationQueue::Message> coalesced_queue;
+static NotificationFilterSlot msg_filter;
+static NotificationSignal msg_signal;
+static DeployTimer deploy_timer;
+// set between init_bridge and finalize_bridge; async tasks keep on_message
+// installed for deploy_timer without it, then nothing is queued
+static std::atomic<bool> listening{false};
+static std::atomic<int> running_tasks{0};
+static std::mutex handler_mutex;
+// deploy notifications seen, before any filter; schema caches on the Lua
+// side add it to their own generation
+static std::atomic<uint64_t> deploy_generation{0};
 
 static void on_message(void* context_object,
     RimeSessionId session_id,
     const char* msg_type,
     const char* msg_value) {
-  const std::string type = std::string(msg_type ? msg_type : "");
-  const std::string value = std::string(msg_value ? msg_value : "");
-  {
-    std::lock_guard<std::mutex> lock(noti_mutex);
-    msg_queue.push_back({session_id, type, value});
+  if (msg_type && strcmp(msg_type, "deploy") == 0) {
+    deploy_generation.fetch_add(1, std::memory_order_relaxed);
+    deploy_timer.OnDeploy(msg_value);
+  }
+  if (!listening.load(std::memory_order_relaxed))
+    return;
+  if (NotificationFilter* filter = msg_filter.get()) {
+    if (!filter->Accept(session_id, msg_type))
+      return;
+    if (filter->Coalesce(session_id, msg_type, msg_value)) {
+      msg_signal.Notify();
+      return;
+    }
+  }
+  if (msg_queue->Push(session_id, msg_type, msg_value))
+    msg_signal.Notify();
+}
+
+// installs on_message while listening or a task runs, returns whether it
+// is installed; tasks finishing on their own thread call it too, hence the lock
+static bool update_notification_handler() {
+  std::lock_guard<std::mutex> lock(handler_mutex);
+  const bool needed = listening.load() || running_tasks.load() > 0;
+  rime_api->set_notification_handler(needed ? on_message : nullptr, nullptr);
+  return needed;
+}
+
+// move up to limit messages from the ring into back_queue
+static void stage_notifications(size_t limit) {
+  if (back_count >= limit) return;
+  size_t want = msg_queue->size();
+  if (want > limit - back_count) want = limit - back_count;
+  if (back_queue.size() < back_count + want) back_queue.resize(back_count + want);
+  for (; want > 0 && msg_queue->Pop(&back_queue[back_count]); --want)
+    ++back_count;
+  // coalesced option values follow as the latest state, all of them, a
+  // drain keeps what exceeds its limit staged
+  NotificationFilter* filter = msg_filter.get();
+  if (back_count < limit && filter) {
+    const size_t n = filter->TakeCoalesced(&coalesced_queue);
+    if (back_queue.size() < back_count + n) back_queue.resize(back_count + n);
+    for (size_t i = 0; i < n; i++)
+      std::swap(back_queue[back_count++], coalesced_queue[i]);
+  }
+}
+
+static size_t fill_notifications(const std::vector<NotificationQueue::Message>& queue,
+    size_t count,
+    RimeSessionId* session_ids,
+    const char** message_types,
+    const char** message_values,
+    int64_t* timestamps) {
+  for (size_t i = 0; i < count; i++) {
+    session_ids[i] = queue[i].session_id;
+    message_types[i] = queue[i].type.c_str();
+    message_values[i] = queue[i].value.c_str();
+    if (timestamps) timestamps[i] = queue[i].timestamp;
   }
+  return count;
+}
+
+// what the task_*_bridge functions hand out: deploy tasks detach their
+// thread when freed, pool jobs only share the completion
+struct BridgeTask {
+  std::unique_ptr<RimeTask> task;
+  std::shared_ptr<Completion> completion;
+};
+
+// null without concurrency mode, nothing would serialize the task's librime
+// calls with the caller's
+static BridgeTask* start_task(std::function<RimeTask::Result()> work) {
+  if (!SessionLocks::Shared().enabled()) return nullptr;
+  ensure_rime_api();
+  if (running_tasks.fetch_add(1) == 0)
+    update_notification_handler();
+  auto* t = new BridgeTask;
+  t->task = std::make_unique<RimeTask>([work]() {
+    const RimeTask::Result result = work();
+    if (--running_tasks == 0)
+      update_notification_handler();
+    return result;
+  });
+  t->completion = t->task->completion();
+  return t;
+}
+
+// FileWatcher plus the paths of its last wait, handed to Lua joined by '\n'
+struct BridgeWatcher {
+  explicit BridgeWatcher(const std::vector<std::string>& dirs) : watcher(dirs) {}
+  FileWatcher watcher;
+  std::string changed;
+};
+
+static BridgeTask* post_job(std::function<int64_t()> job) {
+  auto* t = new BridgeTask;
+  t->completion = std::make_shared<Completion>();
+  WorkerPool::PostShared([completion = t->completion, job]() {
+    completion->Set(job());
+  });
+  return t;
 }
 
 extern "C" {
+  // pending messages, callers may size their arrays with it
+  RIME_API size_t notification_count_bridge() {
+    return back_count + msg_queue->size() + msg_filter.pending();
+  }
+
+  RIME_API uint64_t deploy_generation_bridge() {
+    return deploy_generation.load(std::memory_order_relaxed);
+  }
+
+  // applied by on_message from the next notification on; no types, no
+  // sessions and coalesce == 0 removes the filter. The replaced filter is
+  // freed by finalize_bridge, its counts are kept
+  RIME_API void set_notification_filter_bridge(
+      const char** types, size_t type_count,
+      const RimeSessionId* sessions, size_t session_count,
+      int coalesce) {
+    if (type_count == 0 && session_count == 0 && !coalesce) {
+      msg_filter.Reset();
+      return;
+    }
+    std::vector<std::string> type_vec;
+    for (size_t i = 0; i < type_count; i++)
+      if (types[i]) type_vec.emplace_back(types[i]);
+    std::vector<RimeSessionId> session_vec(sessions, sessions + session_count);
+    msg_filter.Reset(std::make_unique<NotificationFilter>(
+        std::move(type_vec), std::move(session_vec), coalesce != 0));
+  }
+
+  // readable once notifications arrive after the last drain, -1 if the
+  // platform has no pollable fd
+  RIME_API int notification_fd_bridge() {
+    return msg_signal.fd([]() { return notification_count_bridge() > 0; });
+  }
+
+  // steady clock in ns, the clock of notification timestamps
+  RIME_API int64_t steady_time_bridge() {
+    return NotificationQueue::Now();
+  }
+
+  // deploy runs seen so far (at most DeployTimer::kMaxRuns), oldest first
+  RIME_API size_t deploy_timings_bridge(int64_t* starts, int64_t* finishes,
+      int* successes, size_t max_runs, int clear) {
+    const std::vector<DeployTimer::Run> runs = deploy_timer.Runs(clear != 0);
+    const size_t count = runs.size() < max_runs ? runs.size() : max_runs;
+    for (size_t i = 0; i < count; i++) {
+      starts[i] = runs[i].start;
+      finishes[i] = runs[i].finish;
+      successes[i] = runs[i].success ? 1 : 0;
+    }
+    return count;
+  }
+
+  RIME_API void notification_filter_stats_bridge(uint64_t* filtered,
+      uint64_t* coalesced) {
+    if (filtered) *filtered = msg_filter.filtered();
+    if (coalesced) *coalesced = msg_filter.coalesced();
+  }
+
+  // like drain_notifications_timed without consuming. The strings belong to
+  // the staged messages, which the next peek_notifications or drain moves
+  // or reallocates: the pointers are valid until then only, copy them out
+  // (ffi.string) before calling either again
+  RIME_API size_t peek_notifications(
+      RimeSessionId* session_ids,
+      const char** message_types,
+      const char** message_values,
+      int64_t* timestamps,
+      size_t max_messages) {
+    stage_notifications(max_messages);
+    const size_t count = back_count < max_messages ? back_count : max_messages;
+    return fill_notifications(back_queue, count,
+        session_ids, message_types, message_values, timestamps);
+  }
+
+  // timestamps (may be null) get the steady clock time of each message in ns
+  RIME_API size_t drain_notifications_timed(
+      RimeSessionId* session_ids,
+      const char** message_types,
+      const char** message_values,
+      int64_t* timestamps,
+      size_t max_messages) {
+    msg_signal.Rearm();
+    stage_notifications(max_messages);
+    const size_t count = back_count < max_messages ? back_count : max_messages;
+    front_queue.swap(back_queue);
+    // messages beyond max_messages stay staged for the next drain
+    const size_t rest = back_count - count;
+    if (back_queue.size() < rest) back_queue.resize(rest);
+    for (size_t i = 0; i < rest; i++)
+      std::swap(back_queue[i], front_queue[count + i]);
+    back_count = rest;
+    // still readable for what was left
+    if (notification_count_bridge() > 0) msg_signal.Signal();
+    return fill_notifications(front_queue, count,
+        session_ids, message_types, message_values, timestamps);
+  }
+
   RIME_API size_t drain_notifications(
       RimeSessionId* session_ids,
       const char** message_types,
       const char** message_values,
       size_t max_messages) {
-    size_t count = 0;
-    {
-      std::lock_guard<std::mutex> lock(noti_mutex);
-      lua_queue = msg_queue;
-      count = (msg_queue.size() < max_messages) ? msg_queue.size() : max_messages;
-      std::vector<RimeNotificationMsg>().swap(msg_queue); // clear the queue
-    }
-    for (size_t i = 0; i < count; i++) {
-      session_ids[i] = lua_queue[i].id;
-      message_types[i] = lua_queue[i].type.c_str();
-      message_values[i] = lua_queue[i].value.c_str();
-    }
-    return count;
+    return drain_notifications_timed(session_ids, message_types,
+        message_values, nullptr, max_messages);
+  }
+
+  // takes effect for the next init_bridge, refused while a deploy may be
+  // notifying from another thread
+  RIME_API int set_notification_capacity_bridge(size_t capacity) {
+    if (capacity == 0) return 0;
+    ensure_rime_api();
+    if (capacity == msg_queue->capacity()) return 1;
+    std::lock_guard<std::mutex> lock(handler_mutex);
+    if (running_tasks.load() > 0 || rime_api->is_maintenance_mode()) return 0;
+    rime_api->set_notification_handler(nullptr, nullptr);
+    auto queue = std::make_unique<NotificationQueue>(capacity);
+    queue->Adopt(msg_queue.get());
+    msg_queue = std::move(queue);
+    return 1;
+  }
+
+  RIME_API void notification_stats_bridge(size_t* capacity, size_t* pending,
+      uint64_t* dropped, uint64_t* overflowed) {
+    if (capacity) *capacity = msg_queue->capacity();
+    if (pending) *pending = notification_count_bridge();
+    if (dropped) *dropped = msg_queue->dropped();
+    if (overflowed) *overflowed = msg_queue->overflowed();
   }
 
   RIME_API int init_bridge() {
     ensure_rime_api();
-    rime_api->set_notification_handler(on_message, nullptr);
+    listening = true;
+    update_notification_handler();
     FREE_RIME();
     return 0;
   }
 
+  // blocks until every deploy task and pool job returned, their handles
+  // may have been freed already, then joins the worker pool; before
+  // librime goes away
+  RIME_API void wait_jobs_bridge() {
+    PendingJobs::Shared().WaitIdle();
+    WorkerPool::Shutdown();
+  }
+
   RIME_API void finalize_bridge() {
     ensure_rime_api();
-    rime_api->set_notification_handler(nullptr, nullptr);
+    listening = false;
+    const bool idle = !update_notification_handler();
     FREE_RIME();
-    std::vector<RimeNotificationMsg>().swap(lua_queue); // clear the lua queue
-    std::lock_guard<std::mutex> lock(noti_mutex);
-    std::vector<RimeNotificationMsg>().swap(msg_queue); // clear the queue
+    std::vector<NotificationQueue::Message>().swap(front_queue); // clear the lua queues
+    std::vector<NotificationQueue::Message>().swap(back_queue);
+    std::vector<NotificationQueue::Message>().swap(coalesced_queue);
+    back_count = 0;
+    msg_filter.Reset();
+    // with a task running on_message may still hold a replaced filter
+    if (idle) msg_filter.ReleaseRetired();
+    NotificationQueue::Message msg;
+    while (msg_queue->Pop(&msg)) {} // clear the queue
+  }
+
+  // async deploy/maintenance, see RimeTask; the handle must be released
+  // with task_free_bridge, which detaches a running worker. Null without
+  // concurrency mode
+  RIME_API void* task_start_maintenance_bridge(int full_check) {
+    return start_task([full_check]() {
+      return RimeTask::RunMaintenance(rime_api, full_check != 0, &deploy_timer);
+    });
+  }
+
+  RIME_API void* task_deploy_bridge() {
+    return start_task([]() {
+      auto lock = RimeTask::LockDeploy();
+      return rime_api->deploy() ? RimeTask::kSuccess : RimeTask::kFailure;
+    });
+  }
+
+  RIME_API void* task_deploy_schema_bridge(const char* schema_file) {
+    std::string file = schema_file ? schema_file : "";
+    return start_task([file]() {
+      auto lock = RimeTask::LockDeploy();
+      return rime_api->deploy_schema(file.c_str()) ? RimeTask::kSuccess : RimeTask::kFailure;
+    });
+  }
+
+  RIME_API void* task_deploy_config_file_bridge(const char* file_name, const char* version_key) {
+    std::string file = file_name ? file_name : "";
+    std::string key = version_key ? version_key : "";
+    return start_task([file, key]() {
+      auto lock = RimeTask::LockDeploy();
+      return rime_api->deploy_config_file(file.c_str(), key.c_str())
+          ? RimeTask::kSuccess : RimeTask::kFailure;
+    });
+  }
+
+  // runs one of sync_user_data, select_schema(session, arg1),
+  // backup_user_dict(arg1), export_user_dict(arg1, arg2),
+  // import_user_dict(arg1, arg2) on the worker pool; null if unsupported or
+  // without concurrency mode
+  RIME_API void* task_async_bridge(const char* method, RimeSessionId session_id,
+      const char* arg1, const char* arg2) {
+    if (!method || !SessionLocks::Shared().enabled()) return nullptr;
+    ensure_rime_api();
+    RimeApi* api = rime_api;
+    const std::string a1 = arg1 ? arg1 : "", a2 = arg2 ? arg2 : "";
+    if (strcmp(method, "sync_user_data") == 0)
+      return post_job([api]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return api->sync_user_data();
+      });
+    if (strcmp(method, "select_schema") == 0)
+      return post_job([api, session_id, a1]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return api->select_schema(session_id, a1.c_str());
+      });
+    RimeLeversApi* levers = RIMELEVERSAPI;
+    if (strcmp(method, "backup_user_dict") == 0)
+      return post_job([levers, a1]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return levers->backup_user_dict(a1.c_str());
+      });
+    if (strcmp(method, "export_user_dict") == 0)
+      return post_job([levers, a1, a2]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return levers->export_user_dict(a1.c_str(), a2.c_str());
+      });
+    if (strcmp(method, "import_user_dict") == 0)
+      return post_job([levers, a1, a2]() -> int64_t {
+        auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+        return levers->import_user_dict(a1.c_str(), a2.c_str());
+      });
+    return nullptr;
+  }
+
+  RIME_API int task_done_bridge(void* task) {
+    return task && static_cast<BridgeTask*>(task)->completion->done() ? 1 : 0;
+  }
+
+  // deploy tasks: 1 success, 2 failure, 3 skipped, 4 unknown; pool jobs: what the call
+  // returned. Meaningful once done
+  RIME_API int64_t task_value_bridge(void* task) {
+    return task ? static_cast<BridgeTask*>(task)->completion->value() : 0;
+  }
+
+  // 1 when done, 0 on timeout; a negative timeout waits until done
+  RIME_API int task_wait_bridge(void* task, double timeout_seconds) {
+    return task && static_cast<BridgeTask*>(task)->completion->Wait(timeout_seconds) ? 1 : 0;
+  }
+
+  RIME_API int task_fd_bridge(void* task) {
+    return task ? static_cast<BridgeTask*>(task)->completion->fd() : -1;
+  }
+
+  // a deploy task still running keeps going on its own
+  RIME_API void task_free_bridge(void* task) {
+    delete static_cast<BridgeTask*>(task);
+  }
+
+  // DeployManifest for the FFI binding: results[i] is 0 skipped, 1 deployed,
+  // 2 failed, 3 restored from the cache; is_schema[i] nonzero for schema
+  // files, manifest and cache may be null
+  RIME_API void deploy_incremental_bridge(const char** files, const char** version_keys,
+      const int* is_schema, size_t count, const char* manifest, int threads, int force,
+      const char* cache, unsigned long long cache_size, int* results) {
+    ensure_rime_api();
+    std::vector<DeployManifest::Item> items(count);
+    for (size_t i = 0; i < count; ++i) {
+      items[i].file = files[i] ? files[i] : "";
+      items[i].version_key = version_keys && version_keys[i] ? version_keys[i] : "config_version";
+      items[i].is_schema = is_schema[i] != 0;
+    }
+    const auto r = deploy_incremental(rime_api, items, manifest ? manifest : "",
+                                      threads > 0 ? (size_t)threads : 0, force != 0,
+                                      cache ? cache : "", (uintmax_t)cache_size);
+    for (size_t i = 0; i < count; ++i) results[i] = (int)r[i];
+  }
+
+  // DeployManifest inputs of one item joined by '\n', valid until the next call
+  RIME_API const char* deploy_inputs_bridge(const char* file, const char* version_key,
+                                            int is_schema) {
+    static std::string joined;
+    ensure_rime_api();
+    DeployManifest::Item item{file ? file : "", version_key ? version_key : "config_version",
+                              is_schema != 0};
+    joined.clear();
+    for (const auto& path : deploy_inputs(rime_api, item)) {
+      if (!joined.empty()) joined += '\n';
+      joined += path.string();
+    }
+    return joined.c_str();
+  }
+
+  RIME_API void resource_usage_bridge(uint64_t* rss, uint64_t* max_rss, uint64_t* minor_faults,
+                                      uint64_t* major_faults) {
+    const ResourceUsage usage = resource_usage();
+    *rss = usage.rss;
+    *max_rss = usage.max_rss;
+    *minor_faults = usage.minor_faults;
+    *major_faults = usage.major_faults;
+  }
+
+  // MemoryDirs root, user data, staging and log dirs joined by '\n', or the
+  // error with ok set to 0; valid until the next call
+  RIME_API const char* memory_dirs_create_bridge(const char* seed, int* ok) {
+    static std::string joined;
+    MemoryDirs::Dirs dirs;
+    std::string error;
+    *ok = MemoryDirs::Shared().Create(seed ? seed : "", &dirs, &error);
+    joined = *ok ? dirs.root + '\n' + dirs.user_data_dir + '\n' + dirs.staging_dir + '\n' +
+                   dirs.log_dir
+                 : error;
+    return joined.c_str();
+  }
+
+  RIME_API size_t memory_dirs_release_bridge() {
+    return MemoryDirs::Shared().Release();
+  }
+
+  // clone_dir for the FFI binding; counts is files, cloned, linked, copied,
+  // bytes_copied. Null on success, else the error valid until the next call
+  RIME_API const char* clone_dir_bridge(const char* src, const char* dest, int link_artifacts,
+                                        uint64_t* counts, double* seconds) {
+    static std::string error;
+    CloneStats stats;
+    error.clear();
+    if (!clone_dir(src ? src : "", dest ? dest : "", link_artifacts != 0, &stats, &error))
+      return error.c_str();
+    counts[0] = stats.files;
+    counts[1] = stats.cloned;
+    counts[2] = stats.linked;
+    counts[3] = stats.copied;
+    counts[4] = stats.bytes_copied;
+    *seconds = stats.seconds;
+    return nullptr;
+  }
+
+  // FileWatcher for the FFI binding; null when no dir could be watched
+  RIME_API void* watch_open_bridge(const char** dirs, size_t count) {
+    std::vector<std::string> list;
+    for (size_t i = 0; i < count; ++i)
+      if (dirs[i]) list.push_back(dirs[i]);
+    auto* w = new BridgeWatcher(list);
+    if (w->watcher.ok()) return w;
+    delete w;
+    return nullptr;
+  }
+
+  // changed paths joined by '\n', empty on timeout; valid until the next wait
+  RIME_API const char* watch_wait_bridge(void* w, int debounce_ms, double timeout_seconds,
+                                         int* overflow) {
+    auto* watcher = static_cast<BridgeWatcher*>(w);
+    bool dropped = false;
+    watcher->changed.clear();
+    for (const auto& path : watcher->watcher.Wait(debounce_ms, timeout_seconds, &dropped)) {
+      if (!watcher->changed.empty()) watcher->changed += '\n';
+      watcher->changed += path;
+    }
+    *overflow = dropped ? 1 : 0;
+    return watcher->changed.c_str();
+  }
+
+  RIME_API int watch_fd_bridge(void* w) {
+    return static_cast<BridgeWatcher*>(w)->watcher.fd();
+  }
+
+  RIME_API void watch_close_bridge(void* w) {
+    delete static_cast<BridgeWatcher*>(w);
+  }
+
+  // Prefetcher for the FFI binding; the task value is the bytes prefetched
+  RIME_API void* task_prefetch_bridge(const char* schema_id, int lock) {
+    ensure_rime_api();
+    return post_job([id = std::string(schema_id ? schema_id : ""), lock]() -> int64_t {
+      return (int64_t)prefetch_schema(rime_api, id, lock != 0);
+    });
+  }
+
+  RIME_API void prefetch_stats_bridge(uint64_t* files, uint64_t* bytes, uint64_t* locked,
+                                      double* seconds) {
+    const Prefetcher::Stats stats = Prefetcher::Shared().last();
+    *files = stats.files;
+    *bytes = stats.bytes;
+    *locked = stats.locked;
+    *seconds = stats.seconds;
+  }
+
+  RIME_API uint64_t prefetch_unlock_bridge() {
+    return Prefetcher::Shared().Unlock();
+  }
+
+  RIME_API void page_cache_residency_bridge(const char* schema_id, uint64_t* files,
+                                            uint64_t* bytes, uint64_t* resident) {
+    ensure_rime_api();
+    const CacheResidency residency =
+        page_cache_residency(schema_artifacts(rime_api, schema_id ? schema_id : ""));
+    *files = residency.files;
+    *bytes = residency.bytes;
+    *resident = residency.resident;
+  }
+
+  // what is left resident after evicting
+  RIME_API void evict_page_cache_bridge(const char* schema_id, uint64_t* files,
+                                        uint64_t* bytes, uint64_t* resident) {
+    ensure_rime_api();
+    const CacheResidency residency =
+        evict_page_cache(schema_artifacts(rime_api, schema_id ? schema_id : ""));
+    *files = residency.files;
+    *bytes = residency.bytes;
+    *resident = residency.resident;
+  }
+
+  // warm_up_inputs joined by '\n', valid until the next call
+  RIME_API const char* warm_up_inputs_bridge(const char* schema_id, size_t count) {
+    static std::string joined;
+    ensure_rime_api();
+    joined.clear();
+    for (const auto& input : warm_up_inputs(rime_api, schema_id ? schema_id : "", count)) {
+      if (!joined.empty()) joined += '\n';
+      joined += input;
+    }
+    return joined.c_str();
+  }
+
+  // warm_up for the FFI binding: seconds[i], candidates[i] and committed[i]
+  // of inputs[i]; returns how many ran, 0 when the schema could not be selected
+  RIME_API size_t warm_up_bridge(const char* schema_id, const char** inputs, size_t count,
+                                 double* seconds, int* candidates, int* committed) {
+    ensure_rime_api();
+    std::vector<std::string> list;
+    for (size_t i = 0; i < count; ++i) list.push_back(inputs[i] ? inputs[i] : "");
+    const auto samples = warm_up(rime_api, schema_id ? schema_id : "", list);
+    for (size_t i = 0; i < samples.size(); ++i) {
+      seconds[i] = samples[i].seconds;
+      candidates[i] = samples[i].candidates;
+      committed[i] = samples[i].committed ? 1 : 0;
+    }
+    return samples.size();
+  }
+
+  // SessionLocks for the FFI binding, which calls librime directly: the
+  // locks taken by lock_acquire_bridge stay held until lock_release_bridge.
+  // scope is 1 for a session call, 2 for a global one; returns the scope
+  // actually locked, 0 when concurrency mode is off
+  RIME_API int set_concurrency_mode_bridge(int enabled) {
+    return SessionLocks::Shared().set_enabled(enabled != 0) ? 1 : 0;
+  }
+
+  RIME_API int lock_acquire_bridge(int scope, RimeSessionId session_id) {
+    if (scope != SessionLocks::kSession && scope != SessionLocks::kGlobal) return 0;
+    auto guard = SessionLocks::Shared().Acquire((SessionLocks::Scope)scope, session_id);
+    if (!guard.held()) return 0;
+    guard.Dismiss();
+    return scope;
+  }
+
+  RIME_API void lock_release_bridge(int scope, RimeSessionId session_id) {
+    SessionLocks::Shared().Unlock((SessionLocks::Scope)scope, session_id);
+  }
+
+  // path is in the native narrow encoding (ACP on Windows)
+  RIME_API int config_load_file_bridge(RimeConfig* config, const char* path) {
+    if (!config || !path || !*path) return 0;
+    ensure_rime_api();
+    MappedFile file{fs::path(path)};
+    if (!file.ok()) return 0;
+    return rime_api->config_load_string(config, file.c_str());
   }
 
   RIME_API const char* readline_bridge(const char* prompt, const char** history, int history_count, const char* context, const char* continuation_prompt) {
@@ -0,0 +1,511 @@
+#pragma once
+
+#include <rime_api.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+// Bounded lock-free queue for librime notifications.
+// Any thread may Push (librime calls the handler from its maintenance thread
+// as well as from the session thread), a single thread Pops. Slots and their
+// strings are allocated up front; a full queue drops the new message.
+class NotificationQueue {
+ public:
+  static constexpr size_t kDefaultCapacity = 1024;
+  // larger capacities are clamped, slots are allocated up front
+  static constexpr size_t kMaxCapacity = size_t(1) << 20;
+  // type/value bytes kept in a slot without touching the heap
+  static constexpr size_t kSlotStringSize = 64;
+
+  struct Message {
+    // reserved so a Message handed to Pop can refill a slot without allocating
+    Message() {
+      type.reserve(kSlotStringSize);
+      value.reserve(kSlotStringSize);
+    }
+    RimeSessionId session_id = 0;
+    // steady clock at Push, nanoseconds
+    int64_t timestamp = 0;
+    std::string type;
+    std::string value;
+  };
+
+  explicit NotificationQueue(size_t capacity = kDefaultCapacity)
+      : capacity_(RoundUp(std::min(capacity, kMaxCapacity))),
+        mask_(capacity_ - 1),
+        slots_(new Slot[capacity_]) {
+    for (size_t i = 0; i < capacity_; ++i)
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  NotificationQueue(const NotificationQueue&) = delete;
+  NotificationQueue& operator=(const NotificationQueue&) = delete;
+
+  // false if the queue was full and the message got dropped; timestamp 0
+  // stamps it now
+  bool Push(RimeSessionId session_id, const char* type, const char* value,
+            int64_t timestamp = 0) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos & mask_];
+      const size_t seq = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->message.session_id = session_id;
+    slot->message.timestamp = timestamp ? timestamp : Now();
+    Assign(&slot->message.type, type);
+    Assign(&slot->message.value, value);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only; the strings are swapped, not copied, so out's previous
+  // buffers go back to the slot for reuse
+  bool Pop(Message* out) {
+    const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Slot* slot = &slots_[pos & mask_];
+    const size_t seq = slot->sequence.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) return false;
+    dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+    out->session_id = slot->message.session_id;
+    out->timestamp = slot->message.timestamp;
+    out->type.swap(slot->message.type);
+    out->value.swap(slot->message.value);
+    slot->sequence.store(pos + capacity_, std::memory_order_release);
+    return true;
+  }
+
+  // approximate while producers are running
+  size_t size() const {
+    const size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+    const size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+  size_t capacity() const { return capacity_; }
+
+  // consumer only, no producer may use old any more: moves its pending
+  // messages over, those that do not fit count as dropped, and carries its
+  // counts on, so replacing a queue loses nothing unaccounted
+  void Adopt(NotificationQueue* old) {
+    Message msg;
+    while (old->Pop(&msg))
+      Push(msg.session_id, msg.type.c_str(), msg.value.c_str(), msg.timestamp);
+    dropped_.fetch_add(old->dropped(), std::memory_order_relaxed);
+    overflowed_.fetch_add(old->overflowed(), std::memory_order_relaxed);
+  }
+  static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  // messages lost because the queue was full
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  // strings that did not fit the buffer of their slot and grew it
+  uint64_t overflowed() const { return overflowed_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence{0};
+    Message message;
+  };
+
+  static size_t RoundUp(size_t n) {
+    size_t cap = 2;
+    while (cap < n) cap <<= 1;
+    return cap;
+  }
+
+  void Assign(std::string* dst, const char* src) {
+    const size_t len = src ? strlen(src) : 0;
+    if (len > dst->capacity())
+      overflowed_.fetch_add(1, std::memory_order_relaxed);
+    dst->assign(src ? src : "", len);
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  // producers and the consumer touch different cache lines
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> overflowed_{0};
+};
+
+// Filter run by on_message on the librime thread, before a message takes a
+// queue slot. Empty types/sessions accept everything; messages without a
+// session (deploy) always pass the session check. With coalesce, "option"
+// messages only keep the latest value per (session, option name) until the
+// next drain instead of being queued.
+class NotificationFilter {
+ public:
+  NotificationFilter(std::vector<std::string> types,
+                     std::vector<RimeSessionId> sessions,
+                     bool coalesce)
+      : types_(std::move(types)), sessions_(std::move(sessions)),
+        coalesce_(coalesce) {
+    std::sort(sessions_.begin(), sessions_.end());
+  }
+  NotificationFilter(const NotificationFilter&) = delete;
+  NotificationFilter& operator=(const NotificationFilter&) = delete;
+
+  bool Accept(RimeSessionId session_id, const char* type) {
+    const char* t = type ? type : "";
+    bool ok = types_.empty() ||
+        std::find(types_.begin(), types_.end(), t) != types_.end();
+    if (ok && session_id && !sessions_.empty())
+      ok = std::binary_search(sessions_.begin(), sessions_.end(), session_id);
+    if (!ok) filtered_.fetch_add(1, std::memory_order_relaxed);
+    return ok;
+  }
+
+  // true if the message was absorbed and must not be queued
+  bool Coalesce(RimeSessionId session_id, const char* type, const char* value) {
+    if (!coalesce_ || !type || !value || strcmp(type, "option") != 0)
+      return false;
+    const char* name = value[0] == '!' ? value + 1 : value;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto inserted = latest_.try_emplace(Key(session_id, name));
+    if (inserted.second)
+      dirty_count_.fetch_add(1, std::memory_order_relaxed);
+    else
+      coalesced_.fetch_add(1, std::memory_order_relaxed);
+    Latest& latest = inserted.first->second;
+    latest.value.assign(value);
+    latest.timestamp = NotificationQueue::Now();
+    return true;
+  }
+
+  // consumer only; moves the latest option values into out[0..n), returns n.
+  // The table is emptied, options of closed sessions do not pile up in it
+  size_t TakeCoalesced(std::vector<NotificationQueue::Message>* out) {
+    if (dirty_count_.load(std::memory_order_relaxed) == 0) return 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (auto& item : latest_) {
+      Latest& latest = item.second;
+      if (out->size() <= n) out->resize(n + 1);
+      NotificationQueue::Message& msg = (*out)[n++];
+      msg.session_id = item.first.first;
+      msg.timestamp = latest.timestamp;
+      msg.type.assign("option");
+      msg.value.swap(latest.value);
+    }
+    latest_.clear();
+    dirty_count_.store(0, std::memory_order_relaxed);
+    return n;
+  }
+
+  // option values waiting in the coalescing table
+  size_t pending() const { return dirty_count_.load(std::memory_order_relaxed); }
+  // messages rejected by types/sessions
+  uint64_t filtered() const { return filtered_.load(std::memory_order_relaxed); }
+  // option values replaced by a newer one before being drained
+  uint64_t coalesced() const { return coalesced_.load(std::memory_order_relaxed); }
+
+ private:
+  using Key = std::pair<RimeSessionId, std::string>;
+  struct Latest {
+    std::string value;
+    int64_t timestamp = 0;
+  };
+
+  const std::vector<std::string> types_;
+  std::vector<RimeSessionId> sessions_;
+  const bool coalesce_;
+  std::mutex mutex_;  // only taken for option messages when coalescing
+  std::map<Key, Latest> latest_;
+  std::atomic<size_t> dirty_count_{0};
+  std::atomic<uint64_t> filtered_{0};
+  std::atomic<uint64_t> coalesced_{0};
+};
+
+// Current filter read lock-free by on_message. Replaced filters stay alive
+// until ReleaseRetired, which the owner calls once no notification can still
+// be using them (router lock held, handler removed), so one racing a swap
+// never sees a dangling pointer. The counts add up over every filter set.
+class NotificationFilterSlot {
+ public:
+  NotificationFilter* get() const { return current_.load(std::memory_order_acquire); }
+  void Reset(std::unique_ptr<NotificationFilter> filter = nullptr) {
+    current_.store(filter.get(), std::memory_order_release);
+    if (owned_) retired_.push_back(std::move(owned_));
+    owned_ = std::move(filter);
+  }
+  void ReleaseRetired() {
+    for (const auto& filter : retired_) {
+      filtered_ += filter->filtered();
+      coalesced_ += filter->coalesced();
+    }
+    retired_.clear();
+  }
+
+  size_t pending() const { return owned_ ? owned_->pending() : 0; }
+  uint64_t filtered() const {
+    uint64_t n = filtered_ + (owned_ ? owned_->filtered() : 0);
+    for (const auto& filter : retired_) n += filter->filtered();
+    return n;
+  }
+  uint64_t coalesced() const {
+    uint64_t n = coalesced_ + (owned_ ? owned_->coalesced() : 0);
+    for (const auto& filter : retired_) n += filter->coalesced();
+    return n;
+  }
+
+ private:
+  std::atomic<NotificationFilter*> current_{nullptr};
+  std::unique_ptr<NotificationFilter> owned_;
+  std::vector<std::unique_ptr<NotificationFilter>> retired_;
+  uint64_t filtered_ = 0;
+  uint64_t coalesced_ = 0;
+};
+
+// File descriptor that turns readable when notifications arrive after the
+// consumer last drained, for poll()/select() based event loops. eventfd on
+// Linux, a non-blocking pipe on other POSIX systems, unavailable on Windows.
+// Created on first use; Notify is a no-op before that, fd() makes up for it.
+class NotificationSignal {
+ public:
+  NotificationSignal() = default;
+  NotificationSignal(const NotificationSignal&) = delete;
+  NotificationSignal& operator=(const NotificationSignal&) = delete;
+  ~NotificationSignal() { Close(); }
+
+  // consumer only; -1 if not supported. Messages queued before the fd
+  // existed never notified it: pending() is asked once it is open, and
+  // true makes it readable right away
+  template <typename Pending>
+  int fd(Pending pending) {
+#ifndef _WIN32
+    if (read_fd_.load(std::memory_order_relaxed) < 0) {
+      Open();
+      if (pending()) Signal();
+    }
+#endif
+    return read_fd_.load(std::memory_order_relaxed);
+  }
+
+  // producers, after a message was queued or coalesced; only the first
+  // message since the last Rearm writes
+  void Notify() {
+    if (read_fd_.load(std::memory_order_acquire) < 0) return;
+    if (armed_.exchange(false, std::memory_order_acq_rel)) Write();
+  }
+
+  // consumer, before taking its snapshot of the queue: consumes the pending
+  // wakeup, later messages make the fd readable again
+  void Rearm() {
+    if (read_fd_.load(std::memory_order_relaxed) < 0) return;
+    Clear();
+    armed_.store(true, std::memory_order_release);
+  }
+
+  // consumer, when it leaves messages behind on purpose
+  void Signal() {
+    if (read_fd_.load(std::memory_order_relaxed) < 0) return;
+    armed_.store(false, std::memory_order_release);
+    Write();
+  }
+
+ private:
+#ifdef _WIN32
+  void Write() {}
+  void Clear() {}
+  void Close() {}
+#else
+  void Open() {
+    int rfd = -1, wfd = -1;
+#ifdef __linux__
+    rfd = wfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (rfd < 0) return;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return;
+    for (int fd : fds) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    rfd = fds[0];
+    wfd = fds[1];
+#endif
+    write_fd_ = wfd;
+    read_fd_.store(rfd, std::memory_order_release);
+  }
+  void Write() {
+#ifdef __linux__
+    const uint64_t one = 1;
+    ssize_t r = write(write_fd_, &one, sizeof(one));
+#else
+    const char one = 1;
+    ssize_t r = write(write_fd_, &one, 1);
+#endif
+    (void)r;  // EAGAIN: already readable
+  }
+  void Clear() {
+    char buf[64];
+    const int fd = read_fd_.load(std::memory_order_relaxed);
+    while (read(fd, buf, sizeof(buf)) > 0) {}
+  }
+  void Close() {
+    const int rfd = read_fd_.exchange(-1);
+    if (rfd < 0) return;
+    if (write_fd_ != rfd) close(write_fd_);
+    close(rfd);
+    write_fd_ = -1;
+  }
+#endif
+
+  std::atomic<int> read_fd_{-1};
+  int write_fd_ = -1;
+  std::atomic<bool> armed_{true};
+};
+
+// Pairs deploy start -> success/failure notifications into per-run
+// durations. Fed from on_message before any filter, so it works whether or
+// not Lua listens for deploy messages.
+class DeployTimer {
+ public:
+  struct Run {
+    int64_t start;   // steady clock, ns
+    int64_t finish;
+    bool success;
+  };
+  // oldest runs are forgotten beyond this
+  static constexpr size_t kMaxRuns = 64;
+
+  void OnDeploy(const char* value) {
+    if (!value) return;
+    const int64_t now = NotificationQueue::Now();
+    if (strcmp(value, "start") == 0) {
+      start_.store(now, std::memory_order_relaxed);
+      return;
+    }
+    const bool success = strcmp(value, "success") == 0;
+    if (!success && strcmp(value, "failure") != 0) return;
+    const int64_t start = start_.exchange(0, std::memory_order_relaxed);
+    if (start == 0) return;  // started before we listened
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (runs_.size() >= kMaxRuns) runs_.erase(runs_.begin());
+    runs_.push_back({start, now, success});
+  }
+
+  // the latest run that finished at or after since
+  bool LastSince(int64_t since, Run* out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (runs_.empty() || runs_.back().finish < since) return false;
+    *out = runs_.back();
+    return true;
+  }
+
+  std::vector<Run> Runs(bool clear) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Run> runs = runs_;
+    if (clear) runs_.clear();
+    return runs;
+  }
+
+ private:
+  std::atomic<int64_t> start_{0};
+  std::mutex mutex_;
+  std::vector<Run> runs_;
+};
+
+// Notification state of one consumer (one lua_State): its own queue, filter
+// and wakeup fd. Fed by NotificationRouter from librime threads.
+struct NotificationSink {
+  std::unique_ptr<NotificationQueue> queue = std::make_unique<NotificationQueue>();
+  NotificationFilterSlot filter;
+  NotificationSignal signal;
+
+  void Deliver(RimeSessionId session_id, const char* type, const char* value) {
+    if (NotificationFilter* f = filter.get()) {
+      if (!f->Accept(session_id, type))
+        return;
+      if (f->Coalesce(session_id, type, value)) {
+        signal.Notify();
+        return;
+      }
+    }
+    if (queue->Push(session_id, type, value))
+      signal.Notify();
+  }
+};
+
+// librime has a single process-wide notification handler; the router fans
+// each message out to every subscribed sink. Dispatch only takes the shared
+// lock, subscribing, unsubscribing and replacing a sink's queue take it
+// exclusively, so a sink is never written after Unsubscribe returns.
+class NotificationRouter {
+ public:
+  // returns the number of subscribers after the call
+  size_t Subscribe(NotificationSink* sink) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (std::find(sinks_.begin(), sinks_.end(), sink) == sinks_.end())
+      sinks_.push_back(sink);
+    return sinks_.size();
+  }
+  size_t Unsubscribe(NotificationSink* sink) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    sinks_.erase(std::remove(sinks_.begin(), sinks_.end(), sink), sinks_.end());
+    return sinks_.size();
+  }
+  bool subscribed(const NotificationSink* sink) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return std::find(sinks_.begin(), sinks_.end(), sink) != sinks_.end();
+  }
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return sinks_.size();
+  }
+
+  // the old filter may still be in use by Dispatch otherwise
+  void ResetFilter(NotificationSink* sink, std::unique_ptr<NotificationFilter> filter = nullptr) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    sink->filter.Reset(std::move(filter));
+    sink->filter.ReleaseRetired();
+  }
+
+  // the old queue may still be in use by Dispatch otherwise
+  void ResizeQueue(NotificationSink* sink, size_t capacity) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto queue = std::make_unique<NotificationQueue>(capacity);
+    queue->Adopt(sink->queue.get());
+    sink->queue = std::move(queue);
+  }
+
+  void Dispatch(RimeSessionId session_id, const char* type, const char* value) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (NotificationSink* sink : sinks_)
+      sink->Deliver(session_id, type, value);
+  }
+
+ private:
+  mutable std::shared_mutex mutex_;
+  std::vector<NotificationSink*> sinks_;
+};
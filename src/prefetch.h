@@ -0,0 +1,285 @@
+#pragma once
+
+#include "deploy_manifest.h"
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Compiled dictionaries of a deployed schema: the .table.bin, .prism.bin
+// and .reverse.bin of every dictionary its staged yaml names (translator,
+// reverse lookup, ...) with their imports, from the staging dir or else the
+// prebuilt dir. A prism renamed by translator/prism is not found.
+inline std::vector<std::filesystem::path> schema_artifacts(RimeApi* api,
+                                                           const std::string& schema_id) {
+  namespace fs = std::filesystem;
+  char user_dir[1024] = {0}, shared_dir[1024] = {0}, staging_dir[1024] = {0},
+       prebuilt_dir[1024] = {0};
+  api->get_user_data_dir_s(user_dir, sizeof(user_dir));
+  api->get_shared_data_dir_s(shared_dir, sizeof(shared_dir));
+  api->get_staging_dir_s(staging_dir, sizeof(staging_dir));
+  api->get_prebuilt_data_dir_s(prebuilt_dir, sizeof(prebuilt_dir));
+  DeployManifest manifest(user_dir, shared_dir, staging_dir, "", "");
+  const fs::path staged = fs::path(staging_dir) / (schema_id + ".schema.yaml");
+  std::vector<fs::path> files;
+  std::error_code ec;
+  const auto dicts = DeployManifest::Dictionaries(manifest.Inputs({staged.string(), "", true}));
+  for (const auto& name : ArtifactCache::ArtifactNames(dicts)) {
+    for (const fs::path& dir : {fs::path(staging_dir), fs::path(prebuilt_dir)}) {
+      if (!dir.empty() && fs::is_regular_file(dir / name, ec)) {
+        files.push_back(dir / name);
+        break;
+      }
+    }
+  }
+  return files;
+}
+
+// Pulls files into the page cache so that the first lookups after
+// select_schema do not fault them in from disk: posix_fadvise(WILLNEED)
+// starts the readahead of the whole file, then every page of a mapping is
+// touched so the call returns once they are resident. With lock the
+// mappings stay mlock'ed until Unlock; a lock beyond RLIMIT_MEMLOCK fails
+// quietly and the file is only prefetched. On Windows the mapping gets
+// PrefetchVirtualMemory (Windows 8 and later) before the walk, and there is
+// no lock. Runs off the Lua thread.
+class Prefetcher {
+ public:
+  struct Stats {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    uint64_t locked = 0;  // bytes held by mlock after this run
+    double seconds = 0;
+  };
+
+  static Prefetcher& Shared() {
+    static Prefetcher prefetcher;
+    return prefetcher;
+  }
+  ~Prefetcher() { Unlock(); }
+
+  // bytes prefetched
+  uint64_t Prefetch(const std::vector<std::filesystem::path>& files, bool lock) {
+    const auto start = std::chrono::steady_clock::now();
+    Stats stats;
+    for (const auto& file : files) {
+      const uint64_t bytes = Touch(file, lock);
+      if (!bytes) continue;
+      ++stats.files;
+      stats.bytes += bytes;
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& entry : locked_) stats.locked += entry.second.size;
+    last_ = stats;
+    return stats.bytes;
+  }
+
+  // of the last finished Prefetch
+  Stats last() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return last_;
+  }
+
+  // releases every locked mapping, returns the bytes unlocked
+  uint64_t Unlock() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    uint64_t bytes = 0;
+    for (const auto& entry : locked_) {
+#ifndef _WIN32
+      munlock(entry.second.addr, entry.second.size);
+      munmap(entry.second.addr, entry.second.size);
+#endif
+      bytes += entry.second.size;
+    }
+    locked_.clear();
+    last_.locked = 0;
+    return bytes;
+  }
+
+ private:
+  // dev/ino of the file mapped, a path deployed again names another one
+  struct Mapping {
+    void* addr;
+    size_t size;
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+  };
+
+  uint64_t Touch(const std::filesystem::path& file, bool lock) {
+#ifdef _WIN32
+    (void)lock;
+    // mapped here, MappedFile would copy page aligned files to the heap
+    HANDLE handle = CreateFileW(file.wstring().c_str(), GENERIC_READ,
+                                FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER fsize;
+    void* addr = nullptr;
+    size_t size = 0;
+    if (GetFileSizeEx(handle, &fsize) && fsize.QuadPart > 0) {
+      size = (size_t)fsize.QuadPart;
+      if (HANDLE mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr)) {
+        addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(handle);
+    if (!addr) return 0;
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range{addr, size};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+    Walk(static_cast<const char*>(addr), size);
+    UnmapViewOfFile(addr);
+    return size;
+#else
+    const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+      ::close(fd);
+      return 0;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      const auto it = locked_.find(file.string());
+      if (it != locked_.end()) {
+        if (it->second.dev == (uint64_t)st.st_dev && it->second.ino == (uint64_t)st.st_ino) {
+          ::close(fd);
+          return it->second.size;
+        }
+        // replaced by a deploy: the old inode is only held by this lock
+        munlock(it->second.addr, it->second.size);
+        munmap(it->second.addr, it->second.size);
+        locked_.erase(it);
+      }
+    }
+    const size_t size = (size_t)st.st_size;
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return 0;
+    madvise(addr, size, MADV_WILLNEED);
+    Walk(static_cast<const char*>(addr), size);
+    if (lock && mlock(addr, size) == 0) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      const Mapping mapping{addr, size, (uint64_t)st.st_dev, (uint64_t)st.st_ino};
+      if (locked_.emplace(file.string(), mapping).second) return size;
+      munlock(addr, size);  // locked meanwhile by another Prefetch
+    }
+    munmap(addr, size);
+    return size;
+#endif
+  }
+  static size_t PageSize() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+  }
+  // one read per page, 16K/64K pages on some arm64 systems
+  static void Walk(const char* data, size_t size) {
+    static const size_t page = PageSize();
+    volatile char sink = 0;
+    for (size_t offset = 0; offset < size; offset += page) sink ^= data[offset];
+    (void)sink;
+  }
+
+  std::mutex mutex_;
+  Stats last_;
+  std::map<std::string, Mapping> locked_;
+};
+
+// schema_artifacts of schema_id through the shared Prefetcher
+inline uint64_t prefetch_schema(RimeApi* api, const std::string& schema_id, bool lock) {
+  return Prefetcher::Shared().Prefetch(schema_artifacts(api, schema_id), lock);
+}
+
+// page cache residency of files, for cold start measurements
+struct CacheResidency {
+  uint64_t files = 0;
+  uint64_t bytes = 0;     // size of the files
+  uint64_t resident = 0;  // bytes of them in the page cache
+};
+
+// bytes of file in the page cache, by mincore over a mapping
+inline uint64_t resident_bytes(int fd, size_t size) {
+#ifdef _WIN32
+  (void)fd;
+  (void)size;
+  return 0;
+#else
+  if (size == 0) return 0;
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) return 0;
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+#ifdef __linux__
+  std::vector<unsigned char> pages((size + page - 1) / page);
+#else
+  std::vector<char> pages((size + page - 1) / page);
+#endif
+  uint64_t resident = 0;
+  if (mincore(addr, size, pages.data()) == 0) {
+    for (size_t i = 0; i < pages.size(); ++i)
+      if (pages[i] & 1) resident += std::min(page, size - i * page);
+  }
+  munmap(addr, size);
+  return resident;
+#endif
+}
+
+inline CacheResidency page_cache_residency(const std::vector<std::filesystem::path>& files) {
+  CacheResidency result;
+#ifndef _WIN32
+  for (const auto& file : files) {
+    const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      ++result.files;
+      result.bytes += (uint64_t)st.st_size;
+      result.resident += resident_bytes(fd, (size_t)st.st_size);
+    }
+    ::close(fd);
+  }
+#else
+  (void)files;
+#endif
+  return result;
+}
+
+// Drops files from the page cache: posix_fadvise(DONTNEED) after flushing
+// them, as only clean pages can go; no privileges needed beyond reading the
+// files. Pages mapped by a running librime stay, so evict between finalize
+// and initialize. Returns the residency left.
+inline CacheResidency evict_page_cache(const std::vector<std::filesystem::path>& files) {
+#ifndef _WIN32
+  for (const auto& file : files) {
+    const int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    fdatasync(fd);
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    ::close(fd);
+  }
+#endif
+  return page_cache_residency(files);
+}
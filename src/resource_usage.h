@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+// Memory and page faults of this process so far, to be diffed around a
+// call: resident set size now and at its peak, and the page faults served
+// from memory (minor) or needing a read (major). Windows counts every fault
+// as minor.
+struct ResourceUsage {
+  uint64_t rss = 0;
+  uint64_t max_rss = 0;
+  uint64_t minor_faults = 0;
+  uint64_t major_faults = 0;
+};
+
+inline ResourceUsage resource_usage() {
+  ResourceUsage usage;
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    usage.rss = counters.WorkingSetSize;
+    usage.max_rss = counters.PeakWorkingSetSize;
+    usage.minor_faults = counters.PageFaultCount;
+  }
+#else
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+    usage.max_rss = (uint64_t)ru.ru_maxrss;  // bytes
+#else
+    usage.max_rss = (uint64_t)ru.ru_maxrss * 1024;  // KiB
+#endif
+    usage.minor_faults = (uint64_t)ru.ru_minflt;
+    usage.major_faults = (uint64_t)ru.ru_majflt;
+  }
+#ifdef __APPLE__
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+    usage.rss = info.resident_size;
+#else
+  // second field of statm: resident pages
+  if (FILE* f = fopen("/proc/self/statm", "r")) {
+    unsigned long long size = 0, resident = 0;
+    if (fscanf(f, "%llu %llu", &size, &resident) == 2)
+      usage.rss = resident * (uint64_t)sysconf(_SC_PAGESIZE);
+    fclose(f);
+  }
+#endif
+#endif
+  return usage;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "noti_queue.h"
+#include "session_locks.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
+// Outcome of work running off the Lua thread, shared by the worker and the
+// Lua handle. Lua polls done(), blocks in Wait, or yields from a coroutine
+// until fd() turns readable / done() is true.
+class Completion {
+ public:
+  bool done() const { return done_.load(std::memory_order_acquire); }
+  // meaningful once done
+  int64_t value() const { return value_; }
+
+  // longer timeouts wait until done, a steady_clock deadline that far out
+  // would overflow
+  static constexpr double kMaxTimeout = 1e8;  // about 3 years
+
+  // false on timeout; a negative, NaN, infinite or over kMaxTimeout timeout
+  // waits until done
+  bool Wait(double timeout_seconds) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const auto finished = [this] { return done(); };
+    if (!(timeout_seconds >= 0 && timeout_seconds <= kMaxTimeout)) {
+      cv_.wait(lock, finished);
+      return true;
+    }
+    return cv_.wait_for(lock, std::chrono::duration<double>(timeout_seconds), finished);
+  }
+
+  // readable once done, -1 if not supported; Lua thread only
+  int fd() {
+    return signal_.fd([this]() { return done(); });  // finished before the fd existed
+  }
+
+  // worker, once
+  void Set(int64_t value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      value_ = value;
+      done_.store(true, std::memory_order_release);
+    }
+    cv_.notify_all();
+    signal_.Notify();
+  }
+
+ private:
+  std::atomic<bool> done_{false};
+  int64_t value_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  NotificationSignal signal_;
+};
+
+// Work still running off the Lua thread with a RimeApi pointer: pool jobs,
+// and deploy tasks, which keep running once their handle is collected.
+// librime must not be unloaded before WaitIdle returns.
+class PendingJobs {
+ public:
+  static PendingJobs& Shared() {
+    static PendingJobs jobs;
+    return jobs;
+  }
+
+  void Begin() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++count_;
+  }
+  void End() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--count_ == 0) cv_.notify_all();
+  }
+  void WaitIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return count_ == 0; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t count_ = 0;
+};
+
+// Small fixed pool for blocking librime calls (user dict import/export,
+// sync, select_schema on a cold schema). Deploys get their own RimeTask
+// thread instead, they would hold a worker for too long.
+// The shared pool is joined by Shutdown while librime is released, never by
+// a static destructor: joining threads there can deadlock under the Windows
+// loader lock or in dlclose.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t threads) {
+    for (size_t i = 0; i < threads; ++i)
+      workers_.emplace_back([this] { Run(); });
+  }
+  // finishes the queued jobs, then joins
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // counted in PendingJobs until it returned
+  void Post(std::function<void()> job) {
+    PendingJobs::Shared().Begin();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+  }
+
+  // posts to the shared pool, started on first use with 2 to 4 threads
+  static void PostShared(std::function<void()> job) {
+    std::lock_guard<std::mutex> lock(SharedMutex());
+    WorkerPool*& pool = SharedPool();
+    if (!pool)
+      pool = new WorkerPool(std::min(4u, std::max(2u, std::thread::hardware_concurrency())));
+    pool->Post(std::move(job));
+  }
+  // finishes the queued jobs and joins the shared pool; a later PostShared
+  // starts a new one
+  static void Shutdown() {
+    WorkerPool* pool = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(SharedMutex());
+      std::swap(pool, SharedPool());
+    }
+    delete pool;
+  }
+
+ private:
+  // leaked unless Shutdown runs, see above
+  static WorkerPool*& SharedPool() {
+    static WorkerPool* pool = nullptr;
+    return pool;
+  }
+  static std::mutex& SharedMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  void Run() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job();
+      PendingJobs::Shared().End();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> jobs_;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+// Deploy or maintenance work on a dedicated thread.
+class RimeTask {
+ public:
+  // kUnknown: maintenance ran but no deploy outcome was notified
+  enum Result { kRunning = 0, kSuccess, kFailure, kSkipped, kUnknown };
+
+  explicit RimeTask(std::function<Result()> work)
+      : completion_(NewCompletion()),
+        thread_([completion = completion_, work] {
+          completion->Set(work());
+          PendingJobs::Shared().End();
+        }) {}
+  // detaches, a handle collected while the deploy runs must not block its
+  // owner; the thread only shares the completion and its own captures
+  ~RimeTask() {
+    if (thread_.joinable()) thread_.detach();
+  }
+  RimeTask(const RimeTask&) = delete;
+  RimeTask& operator=(const RimeTask&) = delete;
+
+  const std::shared_ptr<Completion>& completion() const { return completion_; }
+  Result result() const {
+    return completion_->done() ? (Result)completion_->value() : kRunning;
+  }
+
+  static const char* ResultName(Result result) {
+    switch (result) {
+      case kSuccess: return "success";
+      case kFailure: return "failure";
+      case kSkipped: return "skipped";
+      case kUnknown: return "unknown";
+      default: return "running";
+    }
+  }
+
+  // held by an async deploy from start to end: one deploy at a time, and the
+  // global lock shared so sessions are served meanwhile, see SessionLocks
+  struct DeployLock {
+    std::unique_lock<std::mutex> deploy;
+    SessionLocks::Guard global;
+  };
+  static DeployLock LockDeploy() {
+    static std::mutex mutex;
+    std::unique_lock<std::mutex> deploy(mutex);
+    return DeployLock{std::move(deploy), SessionLocks::Shared().Acquire(SessionLocks::kShared)};
+  }
+
+  // start_maintenance + join_maintenance_thread; the outcome comes from the
+  // deploy success/failure notification recorded by timer, which needs
+  // on_message to be installed
+  static Result RunMaintenance(RimeApi* api, bool full_check, DeployTimer* timer) {
+    const int64_t since = NotificationQueue::Now();
+    auto lock = LockDeploy();
+    if (!api->start_maintenance(full_check)) return kSkipped;  // nothing to deploy
+    api->join_maintenance_thread();
+    DeployTimer::Run run;
+    if (timer->LastSince(since, &run)) return run.success ? kSuccess : kFailure;
+    return kUnknown;  // the notification handler was removed meanwhile
+  }
+
+ private:
+  // counted in PendingJobs before the thread starts, the thread ends it
+  static std::shared_ptr<Completion> NewCompletion() {
+    PendingJobs::Shared().Begin();
+    return std::make_shared<Completion>();
+  }
+
+  std::shared_ptr<Completion> completion_;
+  std::thread thread_;  // last, it starts running in the constructor
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <rime_api.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+
+// Opt-in serialization of librime calls for processes driving one librime
+// from several threads (a lua_State per thread, async tasks). Off by
+// default, Acquire then only loads a flag.
+//
+// librime keeps process-wide state without locks of its own: the session
+// table, the config and dictionary component caches, the deployer and the
+// module registry. Calls touching it hold the global lock exclusively:
+//   setup, initialize, finalize, start_maintenance, deployer_initialize,
+//   prebuild, deploy, deploy_schema, deploy_config_file, sync_user_data,
+//   create_session, destroy_session, cleanup_stale_sessions,
+//   cleanup_all_sessions, select_schema, get_schema_list, free_schema_list,
+//   schema_open, config_open, user_config_open, every config_* call,
+//   register_module, run_task, and the whole levers API.
+// Other calls on a session (process_key, get_context, set_option, ...) hold
+// the global lock shared plus a lock for that session, so different
+// sessions run in parallel and calls on one session are serialized.
+// The async deploys (deploy_async, deploy_schema_async,
+// deploy_config_file_async, start_maintenance_async) need concurrency mode
+// and hold the global lock shared until their deploy is over, the
+// maintenance one through join_maintenance_thread, plus a lock of their own
+// so only one runs at a time: session calls go on meanwhile, the calls
+// holding the global lock exclusively wait for the deploy. Where a waiting
+// exclusive locker holds off new shared ones (Windows, macOS) session calls
+// queue behind it. A plain start_maintenance only holds the global lock
+// while starting the thread.
+// get_version, the directory getters, is_maintenance_mode,
+// join_maintenance_thread, find_module and the free_* / candidate_list_*
+// calls on caller owned structs are not locked. Strings returned by a
+// session call (get_input, get_property) stay valid only until the next
+// call on that session.
+class SessionLocks {
+ public:
+  // kShared: the global lock shared and no session lock, see the async deploys
+  enum Scope { kNone = 0, kSession, kGlobal, kShared };
+  // sessions hash onto a fixed set of mutexes, two sessions rarely share one
+  static constexpr size_t kStripes = 256;
+
+  class Guard {
+   public:
+    Guard() = default;
+    Guard(std::shared_mutex* global, bool exclusive, std::mutex* session)
+        : global_(global), exclusive_(exclusive), session_(session) {}
+    Guard(Guard&& other) noexcept
+        : global_(other.global_), exclusive_(other.exclusive_), session_(other.session_) {
+      other.global_ = nullptr;
+      other.session_ = nullptr;
+    }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    ~Guard() { Release(); }
+
+    bool held() const { return global_ != nullptr; }
+    // leaves the locks held, Unlock releases them later
+    void Dismiss() {
+      global_ = nullptr;
+      session_ = nullptr;
+    }
+    void Release() {
+      if (session_) session_->unlock();
+      if (global_) exclusive_ ? global_->unlock() : global_->unlock_shared();
+      global_ = nullptr;
+      session_ = nullptr;
+    }
+
+   private:
+    std::shared_mutex* global_ = nullptr;
+    bool exclusive_ = false;
+    std::mutex* session_ = nullptr;
+  };
+
+  static SessionLocks& Shared() {
+    static SessionLocks locks;
+    return locks;
+  }
+
+  bool enabled() const { return enabled_.load(std::memory_order_acquire); }
+  // switch before other threads start calling librime; returns the old mode
+  bool set_enabled(bool enabled) { return enabled_.exchange(enabled); }
+
+  Guard Acquire(Scope scope, RimeSessionId session_id = 0) {
+    if (scope == kNone || !enabled()) return Guard();
+    if (scope == kGlobal) {
+      global_.lock();
+      return Guard(&global_, true, nullptr);
+    }
+    global_.lock_shared();
+    if (scope == kShared) return Guard(&global_, false, nullptr);
+    std::mutex* session = &stripes_[StripeOf(session_id)].mutex;
+    session->lock();
+    return Guard(&global_, false, session);
+  }
+
+  // counterpart of a dismissed Guard from Acquire(scope, session_id)
+  void Unlock(Scope scope, RimeSessionId session_id = 0) {
+    if (scope == kGlobal) {
+      global_.unlock();
+    } else if (scope == kSession) {
+      stripes_[StripeOf(session_id)].mutex.unlock();
+      global_.unlock_shared();
+    } else if (scope == kShared) {
+      global_.unlock_shared();
+    }
+  }
+
+  // scope of a RimeApi call by name, see the list above
+  static constexpr Scope ScopeOf(const char* name, bool takes_session) {
+    if (!name) return kGlobal;
+    const char* unlocked[] = {
+      "get_version", "is_maintenance_mode", "join_maintenance_thread",
+      "find_module", "get_user_id", "free_commit", "free_context",
+      "free_status", "candidate_list_next", "candidate_list_end",
+    };
+    for (const char* n : unlocked)
+      if (Equals(name, n)) return kNone;
+    if (StartsWith(name, "get_") && EndsWith(name, "_dir")) return kNone;
+    if (StartsWith(name, "get_") && EndsWith(name, "_dir_s")) return kNone;
+    if (Equals(name, "select_schema") || Equals(name, "destroy_session"))
+      return kGlobal;
+    return takes_session ? kSession : kGlobal;
+  }
+
+ private:
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  static size_t StripeOf(RimeSessionId session_id) {
+    // ids are pointers in librime, the low bits carry no information
+    return (size_t)(((uint64_t)session_id * 0x9E3779B97F4A7C15ull) >> 56) % kStripes;
+  }
+  static constexpr bool Equals(const char* a, const char* b) {
+    while (*a && *a == *b) ++a, ++b;
+    return *a == *b;
+  }
+  static constexpr bool StartsWith(const char* s, const char* prefix) {
+    while (*prefix && *s == *prefix) ++s, ++prefix;
+    return !*prefix;
+  }
+  static constexpr bool EndsWith(const char* s, const char* suffix) {
+    size_t n = 0, m = 0;
+    while (s[n]) ++n;
+    while (suffix[m]) ++m;
+    return n >= m && Equals(s + n - m, suffix);
+  }
+
+  std::atomic<bool> enabled_{false};
+  std::shared_mutex global_;
+  Stripe stripes_[kStripes];
+};
+
+// wraps a librime function pointer so every call holds the locks of scope;
+// the session is the first argument of kSession calls
+template<typename F, SessionLocks::Scope scope>
+struct SerializedCall;
+template<typename R, typename... Args, SessionLocks::Scope scope>
+struct SerializedCall<R (*)(Args...), scope> {
+  R (*func)(Args...);
+  explicit operator bool() const { return func != nullptr; }
+  R operator()(Args... args) const {
+    auto guard = SessionLocks::Shared().Acquire(scope, SessionOf(args...));
+    return func(args...);
+  }
+
+ private:
+  template<typename... Rest>
+  static RimeSessionId SessionOf(RimeSessionId session_id, Rest...) {
+    return scope == SessionLocks::kSession ? session_id : 0;
+  }
+  template<typename First, typename... Rest>
+  static std::enable_if_t<!std::is_same_v<First, RimeSessionId>, RimeSessionId>
+  SessionOf(First, Rest...) { return 0; }
+  static RimeSessionId SessionOf() { return 0; }
+};
+template<SessionLocks::Scope scope, typename F>
+static inline SerializedCall<F, scope> serialized(F func) {
+  return SerializedCall<F, scope>{func};
+}
+
+template<typename F>
+struct takes_session : std::false_type {};
+template<typename R, typename... Args>
+struct takes_session<R (*)(RimeSessionId, Args...)> : std::true_type {};
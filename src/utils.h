@@ -106,3 +106,23 @@ static inline void ensure_rime_api() {
   if (!rime_api) get_api();
   assert(rime_api);
 }
+
+// librime is loaded once per process and shared by every lua_State that
+// opened the module; the last one to be closed unloads it
+static std::mutex rime_api_mutex;
+static int rime_api_refs = 0;
+static inline bool acquire_rime_api() {
+  std::lock_guard<std::mutex> lock(rime_api_mutex);
+  if (!rime_api) get_api();
+  if (!rime_api) return false;
+  ++rime_api_refs;
+  return true;
+}
+// wait_idle, if given, runs before the last reference unloads librime
+static inline void release_rime_api(void (*wait_idle)() = nullptr) {
+  std::lock_guard<std::mutex> lock(rime_api_mutex);
+  if (rime_api_refs == 0 || --rime_api_refs > 0) return;
+  if (wait_idle) wait_idle();
+  rime_api = nullptr;
+  FREE_RIME();
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "session_locks.h"
+#include <rime_api.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+// The count most common first syllables (first code of an entry) of the
+// schema's translator/dictionary, weighted by the entry weights; a-z when
+// the dictionary source is not found. Table dictionaries without spaces in
+// their codes give whole codes.
+inline std::vector<std::string> warm_up_inputs(RimeApi* api, const std::string& schema_id,
+                                               size_t count) {
+  namespace fs = std::filesystem;
+  std::string dictionary;
+  {
+    auto guard = SessionLocks::Shared().Acquire(SessionLocks::kGlobal);
+    RimeConfig config = {0};
+    if (api->schema_open(schema_id.c_str(), &config)) {
+      const char* name = api->config_get_cstring(&config, "translator/dictionary");
+      if (name) dictionary = name;
+      api->config_close(&config);
+    }
+  }
+  std::map<std::string, double> weights;
+  if (!dictionary.empty()) {
+    char user_dir[1024] = {0}, shared_dir[1024] = {0};
+    api->get_user_data_dir_s(user_dir, sizeof(user_dir));
+    api->get_shared_data_dir_s(shared_dir, sizeof(shared_dir));
+    fs::path source = fs::path(user_dir) / (dictionary + ".dict.yaml");
+    std::error_code ec;
+    if (!fs::exists(source, ec)) source = fs::path(shared_dir) / (dictionary + ".dict.yaml");
+    MappedFile file(source);
+    // entries follow the "..." line: text, code, weight, tab separated
+    bool body = false;
+    for (const char* p = file.ok() ? file.c_str() : ""; *p;) {
+      const char* eol = strchr(p, '\n');
+      const std::string line(p, eol ? (size_t)(eol - p) : strlen(p));
+      p = eol ? eol + 1 : p + line.size();
+      if (!body) {
+        body = line.compare(0, 3, "...") == 0;
+        continue;
+      }
+      if (line.empty() || line[0] == '#') continue;
+      const size_t tab = line.find('\t');
+      if (tab == std::string::npos) continue;
+      const size_t code_end = line.find('\t', tab + 1);
+      std::string code = line.substr(tab + 1, code_end == std::string::npos
+                                                  ? std::string::npos : code_end - tab - 1);
+      code = code.substr(0, code.find(' '));
+      while (!code.empty() && (code.back() == '\r' || code.back() == ' ')) code.pop_back();
+      if (code.empty()) continue;
+      const double weight = code_end == std::string::npos
+          ? 1.0 : std::max(1.0, strtod(line.c_str() + code_end + 1, nullptr));
+      weights[code] += weight;
+    }
+  }
+  std::vector<std::pair<std::string, double>> ranked(weights.begin(), weights.end());
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [](const auto& a, const auto& b) { return a.second > b.second; });
+  std::vector<std::string> inputs;
+  for (const auto& entry : ranked) {
+    if (inputs.size() >= count) break;
+    inputs.push_back(entry.first);
+  }
+  if (ranked.empty())
+    for (char c = 'a'; c <= 'z' && inputs.size() < count; ++c) inputs.push_back(std::string(1, c));
+  return inputs;
+}
+
+struct WarmUpSample {
+  std::string input;
+  double seconds;
+  int candidates;
+  bool committed;  // the schema committed something by itself
+};
+
+// Time of each input typed into a hidden session of schema_id, from the
+// first key to the first page of candidates; the session is cleared after
+// every input and destroyed at the end. Only the characters of the
+// schema's speller/alphabet are typed, so no digit, punctuation or space
+// selects or commits a candidate. A schema committing on its own (a table
+// with auto_select at max_code_length) still commits, and learns, what was
+// typed: the sample is marked and the commit read out of the session.
+inline std::vector<WarmUpSample> warm_up(RimeApi* api, const std::string& schema_id,
+                                         const std::vector<std::string>& inputs) {
+  std::vector<WarmUpSample> samples;
+  SessionLocks& locks = SessionLocks::Shared();
+  RimeSessionId session = 0;
+  // librime's default speller/alphabet
+  std::string alphabet = "zyxwvutsrqponmlkjihgfedcba";
+  {
+    auto guard = locks.Acquire(SessionLocks::kGlobal);
+    session = api->create_session();
+    if (session && !api->select_schema(session, schema_id.c_str())) {
+      api->destroy_session(session);
+      session = 0;
+    }
+    RimeConfig config = {0};
+    if (session && api->schema_open(schema_id.c_str(), &config)) {
+      const char* value = api->config_get_cstring(&config, "speller/alphabet");
+      if (value && *value) alphabet = value;
+      api->config_close(&config);
+    }
+  }
+  if (!session) return samples;
+  for (const auto& input : inputs) {
+    std::string typed;
+    for (char c : input)
+      if (alphabet.find(c) != std::string::npos) typed += c;
+    auto guard = locks.Acquire(SessionLocks::kSession, session);
+    const auto start = std::chrono::steady_clock::now();
+    api->simulate_key_sequence(session, typed.c_str());
+    RIME_STRUCT(RimeContext, context);
+    int candidates = 0;
+    if (api->get_context(session, &context)) {
+      candidates = context.menu.num_candidates;
+      api->free_context(&context);
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    RIME_STRUCT(RimeCommit, commit);
+    const bool committed = api->get_commit(session, &commit);
+    if (committed) api->free_commit(&commit);
+    api->clear_composition(session);
+    samples.push_back({input, seconds, candidates, committed});
+  }
+  auto guard = locks.Acquire(SessionLocks::kGlobal);
+  api->destroy_session(session);
+  return samples;
+}